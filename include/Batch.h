@@ -0,0 +1,21 @@
+/**
+ * @file Batch.h
+ * This header file is included in Batch.cpp and Main.cpp. Further details can be found in those files
+ *
+ * @author Martini Davide
+ * @version 1.1
+ * @since 1.1
+ *
+ */
+
+#include "ShadowDetector.h"
+#include "MaskWriter.h"
+#include "BoundedQueue.h"
+
+#ifndef BA__H
+#define BA__H
+
+bool listImages(const string& input, vector<string>& paths);
+int runBatch(const vector<string>& paths, int lStep, int aStep, int bStep, FilterMode filter, const string& outDir,
+    const MaskOutput& output, TaskScheduler& scheduler);
+#endif
@@ -0,0 +1,70 @@
+/**
+ * @file BinIndex.h
+ * This header file is included in BinIndex.cpp, LabelBins.cpp, FindShadow.cpp and Main.cpp. Further details can be found in those files
+ *
+ * @author Martini Davide
+ * @version 1.1
+ * @since 1.1
+ *
+ */
+
+#include <opencv2/core/core.hpp>
+
+#include <vector>
+#include <algorithm>
+
+using namespace cv;
+using namespace std;
+
+#ifndef BI__H
+#define BI__H
+
+/**
+* Quantization of the l*a*b* space in color bins. The bin of a pixel is
+* (a / aStep * nB + b / bStep) * nL + l / lStep, so that bins with equal chromatic
+* values are consecutive and ordered by lightness. The three tables hold the
+* contribution of each channel value to the bin. The multipliers give v / step as
+* (v * mul) >> 16 for every 8 bit value v, and are used by the vectorized kernels.
+*/
+struct BinLayout {
+  int lStep;
+  int aStep;
+  int bStep;
+  int nL;
+  int nA;
+  int nB;
+  int lutL[256];
+  int lutA[256];
+  int lutB[256];
+  int mulL;
+  int mulA;
+  int mulB;
+};
+
+/**
+* Pixels under the mask bucketed by bin. The pixels (linear indices row * cols + col) of
+* the k-th occupied bin bins[k] are pixels[offsets[k]] ... pixels[offsets[k + 1] - 1], in raster order
+*/
+struct BinIndex {
+  vector<int> bins;
+  vector<int> offsets;
+  vector<int> pixels;
+  vector<int> counts; // one counter per bin of the layout. Kept to zero between calls
+};
+
+void makeBinLayout(int lStep, int aStep, int bStep, BinLayout& layout);
+void quantizeBins(const Mat& imgL, const Mat& imgA, const Mat& imgB, const BinLayout& layout, Mat& binImg);
+void buildBinIndex(const Mat& binImg, const Mat& mask, const BinLayout& layout, BinIndex& index);
+
+inline int binL(const BinLayout& layout, int bin){
+  return bin % layout.nL;
+}
+
+inline int binA(const BinLayout& layout, int bin){
+  return bin / layout.nL / layout.nB;
+}
+
+inline int binB(const BinLayout& layout, int bin){
+  return bin / layout.nL % layout.nB;
+}
+#endif
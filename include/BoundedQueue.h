@@ -0,0 +1,75 @@
+/**
+ * @file BoundedQueue.h
+ * Blocking queue with a fixed capacity, used to connect the stages of the batch pipeline.
+ * push() blocks while the queue is full, so a slow stage slows down the ones that feed it
+ * instead of letting items pile up in memory.
+ *
+ * @author Martini Davide
+ * @version 1.1
+ * @since 1.1
+ *
+ */
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+#ifndef BQ__H
+#define BQ__H
+
+template <typename T>
+class BoundedQueue {
+public:
+  explicit BoundedQueue(int capacity) : capacity(capacity), closed(false){}
+
+  /**
+  * Appends an item, waiting while the queue is full. Returns false if the queue has been closed
+  */
+  bool push(const T& item){
+    unique_lock<mutex> lock(m);
+    notFull.wait(lock, [this]{ return closed || (int) items.size() < capacity; });
+    if(closed){
+      return false;
+    }
+    items.push_back(item);
+    notEmpty.notify_one();
+    return true;
+  }
+
+  /**
+  * Removes the oldest item, waiting while the queue is empty. Returns false once the queue
+  * has been closed and all its items have been removed
+  */
+  bool pop(T& item){
+    unique_lock<mutex> lock(m);
+    notEmpty.wait(lock, [this]{ return closed || !items.empty(); });
+    if(items.empty()){
+      return false;
+    }
+    item = items.front();
+    items.pop_front();
+    notFull.notify_one();
+    return true;
+  }
+
+  /**
+  * No more items can be pushed. Items already in the queue can still be popped
+  */
+  void close(){
+    lock_guard<mutex> lock(m);
+    closed = true;
+    notEmpty.notify_all();
+    notFull.notify_all();
+  }
+
+private:
+  deque<T> items;
+  int capacity;
+  bool closed;
+  mutex m;
+  condition_variable notEmpty;
+  condition_variable notFull;
+};
+#endif
@@ -0,0 +1,18 @@
+/**
+ * @file FilterCompare.h
+ * This header file is included in FilterCompare.cpp and Main.cpp. Further details can be found in those files
+ *
+ * @author Martini Davide
+ * @version 1.1
+ * @since 1.1
+ *
+ */
+
+#include "ShadowPipeline.h"
+
+#ifndef FC__H
+#define FC__H
+
+double maskIoU(const Mat& a, const Mat& b);
+int compareFilters(const vector<string>& paths, int lStep, int aStep, int bStep, TaskScheduler& scheduler);
+#endif
@@ -16,12 +16,19 @@
 #include <string>
 #include <sstream>
 #include <vector>
-#include <map>
 #include <cmath>
 #include <thread>
 #include <chrono>
 #include <ctime>
 #include <mutex>
+#include <functional>
+#include <algorithm>
+#include <cstring>
+
+#include "BinIndex.h"
+#include "LabelBins.h"
+#include "TaskScheduler.h"
+#include "Profiler.h"
 
 using namespace cv;
 using namespace std;
@@ -29,6 +36,9 @@ using namespace std;
 #ifndef FS__H
 #define FS__H
 
-void findShadow(Mat imgL, Mat imgA, Mat imgB, tuple<int, int, int> labValues,
-    vector<Point> labPixels, int lStep, int aStep, int bStep, vector<Point>& shadowPoints);
+bool isShadowComponent(const Mat& binImg, const BinLayout& layout, const ComponentSet& cs, int c);
+bool isShadowPart(const Mat& binImg, const BinLayout& layout, const ComponentSet& cs, int c, int runBegin, int runEnd);
+void findShadow(const Mat& binImg, const BinLayout& layout, const ComponentSet& cs, int compBegin, int compEnd,
+    vector<uchar>& shadow);
+void paintShadows(const ComponentSet& cs, const vector<uchar>& shadow, Mat& mask);
 #endif
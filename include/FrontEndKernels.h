@@ -0,0 +1,28 @@
+/**
+ * @file FrontEndKernels.h
+ * This header file is included in FrontEndKernels.cpp, BinIndex.cpp and ShadowPipeline.cpp. Further details can be found in those files
+ *
+ * @author Martini Davide
+ * @version 1.1
+ * @since 1.1
+ *
+ */
+
+#include <opencv2/core/core.hpp>
+
+#include "BinIndex.h"
+
+using namespace cv;
+using namespace std;
+
+#ifndef FK__H
+#define FK__H
+
+void lightnessHistogram(const Mat& imgL, int hist[256]);
+void lightnessStats(const int hist[256], double& meanL, double& stdDevL);
+int lightnessThreshold(double threshold);
+int maskRow(const uchar* l, int n, int threshold, uchar* mask);
+void quantizeRow(const uchar* l, const uchar* a, const uchar* b, int n, const BinLayout& layout, int* bin);
+int maskAndBinsRow(const uchar* l, const uchar* a, const uchar* b, int n, int threshold, const BinLayout& layout,
+    uchar* mask, int* bin);
+#endif
@@ -0,0 +1,72 @@
+/**
+ * @file LabelBins.h
+ * This header file is included in LabelBins.cpp, FindShadow.cpp and Main.cpp. Further details can be found in those files
+ *
+ * @author Martini Davide
+ * @version 1.1
+ * @since 1.1
+ *
+ */
+
+#include <opencv2/core/core.hpp>
+
+#include <vector>
+#include <algorithm>
+
+#include "BinIndex.h"
+
+using namespace cv;
+using namespace std;
+
+#ifndef LB__H
+#define LB__H
+
+/**
+* Horizontal run of pixels [colBegin, colEnd) on a row, all belonging to the same component
+*/
+struct Run {
+  int row;
+  int colBegin;
+  int colEnd;
+};
+
+/**
+* Connected region of mask pixels sharing the same bin. Its runs are stored contiguously
+* in ComponentSet::runs starting at firstRun
+*/
+struct BinComponent {
+  int bin;
+  int area;
+  Rect bbox;
+  int firstRun;
+  int numRuns;
+};
+
+/**
+* Components with the same bin. They are stored contiguously in ComponentSet::comps starting at firstComp
+*/
+struct BinGroup {
+  int bin;
+  int area;
+  int firstComp;
+  int numComps;
+};
+
+/**
+* Output of labelBins(): runs grouped by component and components grouped by bin
+*/
+struct ComponentSet {
+  vector<Run> runs;
+  vector<BinComponent> comps;
+  vector<BinGroup> groups;
+
+  // scratch of labelBins(), kept so that repeated calls do not allocate
+  vector<Run> rawRuns;
+  vector<int> rawBin;
+  vector<int> parent;
+  vector<int> runComp;
+  vector<int> fill;
+};
+
+void labelBins(const BinIndex& index, int cols, ComponentSet& cs);
+#endif
@@ -0,0 +1,41 @@
+/**
+ * @file MaskWriter.h
+ * This header file is included in MaskWriter.cpp, Main.cpp, Sweep.cpp and Batch.cpp. Further details can be found in those files
+ *
+ * @author Martini Davide
+ * @version 1.1
+ * @since 1.1
+ *
+ */
+
+#include "ShadowPipeline.h"
+
+#include <cstdio>
+#include <fstream>
+
+#ifndef MW__H
+#define MW__H
+
+/**
+* File format of the written masks. See MaskWriter.cpp
+*/
+enum MaskFormat {
+  MASK_PNG, // lossless, fast compression. Default
+  MASK_JPG, // lossy, as in the original pipeline
+  MASK_PBM, // one bit per pixel, no compression
+  MASK_RLE // runs of each connected region of the mask
+};
+
+/**
+* How the masks of a run are written
+*/
+struct MaskOutput {
+  MaskFormat format = MASK_PNG;
+  bool mapped = false; // write PBM files through a memory mapping
+  bool intermediate = true; // write the PSP mask as well
+};
+
+bool parseMaskFormat(const string& name, MaskFormat& format);
+string maskExtension(MaskFormat format);
+bool writeMask(const string& path, const Mat& mask, const MaskOutput& output, bool binary = true);
+#endif
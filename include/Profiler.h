@@ -0,0 +1,71 @@
+/**
+ * @file Profiler.h
+ * This header file is included in every file that measures its stages. Further details can be found in Profiler.cpp
+ *
+ * @author Martini Davide
+ * @version 1.1
+ * @since 1.1
+ *
+ */
+
+#include <string>
+#include <map>
+#include <atomic>
+#include <chrono>
+
+using namespace std;
+
+#ifndef PR__H
+#define PR__H
+
+/**
+* Quantities summed over all threads while profiling is enabled
+*/
+enum ProfileCounter {
+  COUNTER_IMAGES,
+  COUNTER_BINS, // bins with at least one PSP
+  COUNTER_COMPONENTS,
+  COUNTER_SHADOW_COMPONENTS,
+  COUNTER_BORDER_PIXELS, // border pixels examined by the border test
+  COUNTER_EARLY_EXITS, // components decided before their whole border was examined
+  NUM_COUNTERS
+};
+
+extern atomic<bool> profilingOn;
+extern atomic<bool> verboseOn;
+
+inline bool profilingEnabled(){ return profilingOn.load(memory_order_relaxed); }
+inline bool verboseEnabled(){ return verboseOn.load(memory_order_relaxed); }
+void setProfiling(bool enabled);
+void setVerbose(bool enabled);
+
+long long profileNowUs();
+void recordEvent(const char* name, long long startUs, long long durationUs);
+void addCounter(ProfileCounter counter, long long value);
+bool writeTrace(const string& path);
+void printProfileSummary();
+void stageTotals(map<string, long long>& totalsUs);
+void resetProfile();
+
+/**
+* Measures the scope it is declared in. Nothing is measured while profiling is disabled
+*/
+class ProfileScope {
+public:
+  explicit ProfileScope(const char* stage) : name(profilingEnabled() ? stage : 0), startUs(name != 0 ? profileNowUs() : 0){}
+  ~ProfileScope(){
+    if(name != 0){
+      recordEvent(name, startUs, profileNowUs() - startUs);
+    }
+  }
+
+private:
+  const char* name;
+  long long startUs;
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+// stage names must be string literals, since only their pointer is stored
+#define PROFILE_SCOPE(stage) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(stage)
+#endif
@@ -0,0 +1,19 @@
+/**
+ * @file Server.h
+ * This header file is included in Server.cpp and Main.cpp. Further details can be found in those files
+ *
+ * @author Martini Davide
+ * @version 1.1
+ * @since 1.1
+ *
+ */
+
+#include "ShadowDetector.h"
+#include "MaskWriter.h"
+#include "BoundedQueue.h"
+
+#ifndef SE__H
+#define SE__H
+
+int runServer(const string& address, int workers, FilterMode filter, const MaskOutput& output);
+#endif
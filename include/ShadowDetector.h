@@ -0,0 +1,95 @@
+/**
+ * @file ShadowDetector.h
+ * This header file is the interface of the shadowdet library. It is included in ShadowDetector.cpp, Main.cpp
+ * and in the programs that embed the detector. Further details can be found in ShadowDetector.cpp
+ *
+ * @author Martini Davide
+ * @version 1.1
+ * @since 1.1
+ *
+ */
+
+#include "ShadowPipeline.h"
+
+#include <memory>
+
+#ifndef SD__H
+#define SD__H
+
+/**
+* Channel order of the pixels of an ImageView
+*/
+enum PixelFormat {
+  PIXEL_BGR8, // 3 bytes per pixel, as returned by imread()
+  PIXEL_RGB8, // 3 bytes per pixel
+  PIXEL_BGRA8, // 4 bytes per pixel, alpha is ignored
+  PIXEL_RGBA8 // 4 bytes per pixel, alpha is ignored
+};
+
+/**
+* Image owned by the caller. It is read in place and never copied
+*/
+struct ImageView {
+  const unsigned char* data; // first pixel of the first row
+  int width;
+  int height;
+  size_t stride; // bytes between the starts of two consecutive rows
+  PixelFormat format;
+};
+
+/**
+* Mask buffer owned by the caller, one byte per pixel. Each SP is set to 255, every other pixel to 0
+*/
+struct MaskView {
+  unsigned char* data; // first pixel of the first row
+  int width;
+  int height;
+  size_t stride; // bytes between the starts of two consecutive rows
+};
+
+/**
+* Parameters of a ShadowDetector
+*/
+struct ShadowConfig {
+  int lStep = 20; // step used to group l* components. It must be positive
+  int aStep = 50; // step used to group a* components. It must be positive
+  int bStep = 50; // step used to group b* components. It must be positive
+  FilterMode filter = FILTER_BILATERAL; // edge preserving filter. See filterLab()
+  int threads = 0; // threads of the detector pool, 0 for one per hardware thread. Unused with a shared pool
+};
+
+/**
+* Detector that keeps its configuration, its thread pool and all its buffers between calls, so that only the first
+* image of a given size allocates the image sized buffers; later calls only allocate the small list of tasks.
+* A detector must not be used by two threads at the same time; use one detector per thread instead, possibly
+* sharing a single TaskScheduler.
+*/
+class ShadowDetector {
+public:
+  explicit ShadowDetector(const ShadowConfig& config = ShadowConfig());
+  ShadowDetector(const ShadowConfig& config, TaskScheduler& scheduler);
+  ShadowDetector(const ShadowDetector&) = delete;
+  ShadowDetector& operator=(const ShadowDetector&) = delete;
+
+  bool configure(const ShadowConfig& config);
+  bool detect(const ImageView& image, const MaskView& mask, DetectStats* stats = 0);
+  bool detect(const Mat& img, Mat& mask, DetectStats* stats = 0);
+
+  const ShadowConfig& config() const { return cfg; }
+  // filtered planes, statistics and PSP mask of the last image
+  const FrontEnd& frontEnd() const { return fe; }
+  TaskScheduler& scheduler() { return *pool; }
+
+private:
+  bool run(const Mat& img, int conversion, Mat& mask, DetectStats* stats);
+
+  ShadowConfig cfg;
+  BinLayout layout;
+  unique_ptr<TaskScheduler> ownPool; // empty when the pool is shared
+  TaskScheduler* pool;
+  FrontEnd fe;
+  DetectScratch scratch;
+};
+
+bool validConfig(const ShadowConfig& config);
+#endif
@@ -0,0 +1,83 @@
+/**
+ * @file ShadowPipeline.h
+ * This header file is included in ShadowPipeline.cpp, ShadowDetector.h, Sweep.cpp and Main.cpp. Further details can be found in those files
+ *
+ * @author Martini Davide
+ * @version 1.1
+ * @since 1.1
+ *
+ */
+
+#include "FindShadow.h"
+#include "FrontEndKernels.h"
+
+#ifndef SP__H
+#define SP__H
+
+/**
+* Edge preserving filter applied to the l*a*b* planes. See filterLab()
+*/
+enum FilterMode {
+  FILTER_BILATERAL, // one bilateral filter per plane. Reference mode
+  FILTER_JOINT, // one bilateral filter over the interleaved planes
+  FILTER_HALF // joint bilateral filter at half resolution, then upsampled
+};
+
+/**
+* Buffers of filterLab(), kept so that repeated calls on images of the same size do not allocate them
+*/
+struct FilterScratch {
+  Mat channels[3]; // unfiltered planes
+  Mat filtered; // filtered l*a*b* image
+  Mat small; // half resolution image
+  Mat smallFiltered;
+};
+
+/**
+* Stages of the pipeline that do not depend on lStep, aStep and bStep
+*/
+struct FrontEnd {
+  Mat imgL; // filtered l* component
+  Mat imgA; // filtered a* component
+  Mat imgB; // filtered b* component
+  Mat maskAvgL; // PSP mask. Each PSP is set to its lightness plus 1, each NSP to 0
+  double meanL;
+  double stdDevL;
+  bool useSTD;
+  int maskPixels; // number of PSP
+  Mat binImg; // bin of each pixel. Empty unless a layout is given to computeFrontEnd()
+  BinLayout layout; // layout used to compute binImg
+  Mat imgLAB; // converted image, kept to reuse its buffer
+  FilterScratch filterScratch;
+};
+
+/**
+* Buffers of detectShadows(). Passing the same scratch to many calls avoids allocating them for every image
+*/
+struct DetectScratch {
+  Mat binImg;
+  BinIndex index;
+  ComponentSet cs;
+  vector<uchar> shadow; // decision of each component
+};
+
+/**
+* Information about a call to detectShadows()
+*/
+struct DetectStats {
+  int bins; // bins with at least one PSP
+  int components;
+  int indexedPixels; // PSP in the bin index. It must be equal to FrontEnd::maskPixels
+};
+
+void filterLab(const Mat& imgLAB, FilterMode filter, Mat& imgL, Mat& imgA, Mat& imgB, FilterScratch* scratch = 0);
+void computeFrontEnd(const Mat& imgRGB, FrontEnd& fe, const BinLayout* layout = 0, FilterMode filter = FILTER_BILATERAL,
+    int conversion = COLOR_RGB2Lab);
+void testBorders(const Mat& binImg, const BinLayout& layout, const ComponentSet& cs, const vector<uchar>* selected,
+    TaskScheduler& scheduler, vector<uchar>& shadow);
+void detectShadows(const FrontEnd& fe, int lStep, int aStep, int bStep, TaskScheduler& scheduler,
+    Mat& maskFinal, DetectStats* stats = 0, DetectScratch* scratch = 0);
+string maskName(int lStep, int aStep, int bStep);
+bool parseFilterMode(const string& name, FilterMode& filter);
+string filterModeName(FilterMode filter);
+#endif
@@ -0,0 +1,25 @@
+/**
+ * @file Sweep.h
+ * This header file is included in Sweep.cpp and Main.cpp. Further details can be found in those files
+ *
+ * @author Martini Davide
+ * @version 1.1
+ * @since 1.1
+ *
+ */
+
+#include "MaskWriter.h"
+
+#ifndef SW__H
+#define SW__H
+
+struct StepTriple {
+  int lStep;
+  int aStep;
+  int bStep;
+};
+
+bool parseSweep(const string& spec, vector<StepTriple>& triples);
+int runSweep(const string& srcPath, const vector<StepTriple>& triples, FilterMode filter, const MaskOutput& output,
+    TaskScheduler& scheduler);
+#endif
@@ -0,0 +1,69 @@
+/**
+ * @file TaskScheduler.h
+ * This header file is included in TaskScheduler.cpp and Main.cpp. Further details can be found in those files
+ *
+ * @author Martini Davide
+ * @version 1.1
+ * @since 1.1
+ *
+ */
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+
+using namespace std;
+
+#ifndef TS__H
+#define TS__H
+
+class TaskScheduler {
+public:
+  explicit TaskScheduler(int numThreads = 0);
+  ~TaskScheduler();
+
+  int size() const;
+  void run(vector<function<void()> >& tasks);
+
+private:
+  struct TaskGroup {
+    atomic<int> pending;
+    TaskGroup* parent; // group of the job that called run(), if any
+    mutex doneMutex;
+    condition_variable doneCv;
+    exception_ptr error;
+  };
+
+  struct Job {
+    function<void()>* fn;
+    TaskGroup* group;
+  };
+
+  struct Worker {
+    mutex m;
+    deque<Job> jobs;
+  };
+
+  TaskScheduler(const TaskScheduler&);
+  TaskScheduler& operator=(const TaskScheduler&);
+
+  void workerLoop(int w);
+  bool takeJob(int w, Job& job, const TaskGroup* waited);
+  bool popJob(Worker* worker, Job& job, const TaskGroup* waited);
+  void execute(Job& job);
+
+  static thread_local TaskGroup* runningGroup; // group of the job the calling thread is executing
+
+  vector<Worker*> workers;
+  vector<thread> threads;
+  mutex sleepMutex;
+  condition_variable wakeCv;
+  int queued; // jobs in the deques. Protected by sleepMutex
+  bool stop; // protected by sleepMutex
+};
+#endif
@@ -0,0 +1,108 @@
+/**
+ * @file Tiled.h
+ * This header file is included in Tiled.cpp and Main.cpp. Further details can be found in those files
+ *
+ * @author Martini Davide
+ * @version 1.1
+ * @since 1.1
+ *
+ */
+
+#include "ShadowPipeline.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#ifndef TI__H
+#define TI__H
+
+/**
+* Source of image rows, so that an image can be processed without holding it in memory
+*/
+class TileSource {
+public:
+  virtual ~TileSource(){}
+  virtual int rows() const = 0;
+  virtual int cols() const = 0;
+  // reads rows [y0, y1) as a CV_8UC3 image with the channel order returned by imread()
+  virtual bool readRows(int y0, int y1, Mat& out) = 0;
+};
+
+/**
+* Binary PPM (P6, 8 bit) read one band at a time from disk
+*/
+class PpmTileSource : public TileSource {
+public:
+  bool open(const string& path);
+  int rows() const { return height; }
+  int cols() const { return width; }
+  bool readRows(int y0, int y1, Mat& out);
+
+private:
+  ifstream file;
+  streamoff dataOffset;
+  int width;
+  int height;
+};
+
+/**
+* Image already decoded in memory. Used for the formats that can not be read by bands
+*/
+class MatTileSource : public TileSource {
+public:
+  explicit MatTileSource(const Mat& img) : img(img){}
+  int rows() const { return img.rows; }
+  int cols() const { return img.cols; }
+  bool readRows(int y0, int y1, Mat& out);
+
+private:
+  Mat img;
+};
+
+/**
+* Run of a component crossing the seam between two bands
+*/
+struct SeamRun {
+  int colBegin;
+  int colEnd;
+  int bin;
+  int gid; // global id of the component
+};
+
+/**
+* Run stored on disk between the labeling and the painting pass
+*/
+struct TiledRun {
+  int row;
+  int colBegin;
+  int colEnd;
+  int gid;
+};
+
+/**
+* State carried from one band to the next. Components get global ids; the ones that cross a seam are merged
+* with a union-find whose roots hold the shadow decision of the whole merged component
+*/
+struct TiledState {
+  BinLayout layout;
+  int threshold; // integer lightness threshold of the PSP. See lightnessThreshold()
+  int cols;
+  FILE* runFile; // runs of all bands, in band order
+  vector<long long> bandRuns; // number of runs written by each band
+  vector<int> parent; // union-find over global ids
+  vector<uchar> shadow; // shadow decision of each global id. Valid on roots
+  vector<SeamRun> seam; // runs on the last row of the previous band
+  long long merges; // components merged across seams
+  Mat mask; // scratch buffers reused by all bands
+  Mat binImg;
+  BinIndex index;
+  ComponentSet cs;
+};
+
+void labelBand(TiledState& state, const Mat& imgL, const Mat& imgA, const Mat& imgB, int extY0, int y0, int y1,
+    TaskScheduler& scheduler);
+void paintBand(TiledState& state, int band, int y0, int y1, Mat& mask);
+int runTiled(const string& srcPath, int lStep, int aStep, int bStep, FilterMode filter, const string& dstPath,
+    int budgetMb, TaskScheduler& scheduler);
+#endif
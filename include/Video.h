@@ -0,0 +1,62 @@
+/**
+ * @file Video.h
+ * This header file is included in Video.cpp and Main.cpp. Further details can be found in those files
+ *
+ * @author Martini Davide
+ * @version 1.1
+ * @since 1.1
+ *
+ */
+
+#include "ShadowPipeline.h"
+
+#include <opencv2/videoio/videoio.hpp>
+
+#ifndef VI__H
+#define VI__H
+
+/**
+* Everything carried from a frame to the next one
+*/
+struct VideoState {
+  BinLayout layout;
+  FilterMode filter;
+  Mat reference; // input pixels the filtered planes were computed from
+  Mat imgL; // filtered l* component
+  Mat imgA; // filtered a* component
+  Mat imgB; // filtered b* component
+  Mat maskAvgL; // PSP mask
+  Mat binImg; // bin of each pixel
+  Mat masks[2]; // final masks of the previous and of the current frame
+  int current; // index in masks of the last final mask
+  int hist[256]; // histogram of imgL
+  int threshold; // PSP threshold. See lightnessThreshold()
+  double meanL;
+  double stdDevL;
+  int tileRows;
+  int tileCols;
+  vector<uchar> changed; // tiles whose input changed
+  vector<uchar> refiltered; // changed tiles and their neighbours
+  vector<int> refilteredSum; // 2D prefix sums of refiltered, (tileRows + 1) x (tileCols + 1)
+  BinIndex index;
+  ComponentSet cs;
+  vector<uchar> shadow; // decision of each component
+  vector<uchar> affected; // 1 for the components analyzed again
+};
+
+/**
+* Information about a call to processFrame()
+*/
+struct FrameStats {
+  int changedTiles;
+  int refilteredTiles;
+  int components;
+  int analyzedComponents;
+  bool fullUpdate; // keyframe or new PSP threshold
+};
+
+void initVideoState(VideoState& state, int lStep, int aStep, int bStep, FilterMode filter);
+void processFrame(VideoState& state, const Mat& frame, bool keyframe, TaskScheduler& scheduler, FrameStats* stats = 0);
+int runVideo(const string& input, int lStep, int aStep, int bStep, FilterMode filter, const string& output,
+    TaskScheduler& scheduler);
+#endif
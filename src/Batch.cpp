@@ -0,0 +1,260 @@
+/**
+ * @file Batch.cpp
+ * The goal of the code in this file is to process many images in a single run.
+ * Images go through three stages connected by bounded queues: decoding, shadow
+ * detection and mask encoding. Each stage has its own threads, so reading the next
+ * images and writing the previous masks overlap with the analysis of the current
+ * ones, while the bounded queues keep the number of images in memory fixed.
+ *
+ * @author Martini Davide
+ * @version 1.1
+ * @since 1.1
+ *
+ */
+
+#include "Batch.h"
+
+#include <sys/stat.h>
+#include <fstream>
+#include <atomic>
+#include <map>
+#include <set>
+
+// threads and queue capacity of each stage. Decoding and encoding are mostly I/O bound, while
+// the analysis spreads its components over the scheduler, so a couple of images in flight
+// are enough to keep the scheduler busy during the serial parts of the pipeline
+const int decodeThreads = 2;
+const int analyzeThreads = 2;
+const int encodeThreads = 2;
+const int queueCapacity = 4;
+
+/**
+* Image moving through the pipeline
+*/
+struct BatchItem {
+  int id; // position in the list of paths
+  Mat img; // decoded image, then final mask
+};
+
+static bool isImageFile(const string& path){
+  const char* extensions[] = {".jpg", ".jpeg", ".png", ".bmp", ".tif", ".tiff", ".ppm", ".pgm", ".webp"};
+  string lower = path;
+  transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+  for(int e = 0; e < sizeof(extensions) / sizeof(extensions[0]); e++){
+    string ext = extensions[e];
+    if(lower.size() > ext.size() && lower.compare(lower.size() - ext.size(), ext.size(), ext) == 0){
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+* Returns the file name of path without folders and extension
+*/
+static string baseName(const string& path){
+  size_t slash = path.find_last_of("/\\");
+  string name = (slash == string::npos) ? path : path.substr(slash + 1);
+  size_t dot = name.find_last_of('.');
+  return (dot == string::npos) ? name : name.substr(0, dot);
+}
+
+/**
+* This function names the mask of each image after the image, without folders and extension. Images that share
+* their name, such as a/img.jpg and b/img.jpg or img.jpg and img.png, get their position in the list appended,
+* so that no mask overwrites another one.
+*
+* @param paths input image paths
+* @param names output names, one per path
+* @return false if two names are still equal, which only happens when an input is named like a renamed one
+*/
+static bool maskNames(const vector<string>& paths, vector<string>& names){
+  map<string, int> uses;
+  names.resize(paths.size());
+  for(int p = 0; p < paths.size(); p++){
+    names[p] = baseName(paths[p]);
+    uses[names[p]]++;
+  }
+
+  set<string> unique;
+  for(int p = 0; p < paths.size(); p++){
+    if(uses[names[p]] > 1){
+      stringstream sstm;
+      sstm << names[p] << "_" << p;
+      names[p] = sstm.str();
+    }
+    if(!unique.insert(names[p]).second){
+      cout << "Can not name the mask of " << paths[p] << ": " << names[p] << " is already used" << endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+* This function collects the images to process.
+*
+* @param input a folder, whose image files are processed in alphabetical order, a single image or a text file with one
+* image path per line
+* @param paths output image paths
+* @return false if input can not be read or contains no image
+*/
+bool listImages(const string& input, vector<string>& paths){
+  paths.clear();
+
+  struct stat info;
+  if(stat(input.c_str(), &info) != 0){
+    return false;
+  }
+
+  if(S_ISDIR(info.st_mode)){
+    vector<String> files;
+    glob(input + "/*", files, false);
+    for(int f = 0; f < files.size(); f++){
+      if(isImageFile(files[f])){
+        paths.push_back(files[f]);
+      }
+    }
+  }
+  else if(isImageFile(input)){
+    paths.push_back(input);
+  }
+  else{
+    ifstream list(input.c_str());
+    string line;
+    while(getline(list, line)){
+      if(!line.empty() && line[line.size() - 1] == '\r'){
+        line.erase(line.size() - 1);
+      }
+      if(!line.empty() && line[0] != '#'){
+        paths.push_back(line);
+      }
+    }
+  }
+
+  return !paths.empty();
+}
+
+/**
+* This function runs the pipeline over all the images. The final mask of each image is written in outDir with the
+* name of the input image followed by the steps. See maskNames(). Images that can not be opened are reported and skipped.
+*
+* @param paths input image paths. See listImages()
+* @param lStep step used to group l* components. It must be positive
+* @param aStep step used to group a* components. It must be positive
+* @param bStep step used to group b* components. It must be positive
+* @param filter edge preserving filter. See ShadowPipeline.cpp
+* @param outDir folder where masks are written. It is created if it does not exist
+* @param output format of the masks. See MaskWriter.cpp
+* @param scheduler pool of threads used by detectShadows(). See TaskScheduler.cpp for more details
+* @return 0 if all images were processed, 1 otherwise
+*/
+int runBatch(const vector<string>& paths, int lStep, int aStep, int bStep, FilterMode filter, const string& outDir,
+    const MaskOutput& output, TaskScheduler& scheduler){
+
+  vector<string> names;
+  if(!maskNames(paths, names)){
+    return 1;
+  }
+
+  mkdir(outDir.c_str(), 0755);
+
+  BoundedQueue<BatchItem> decoded(queueCapacity);
+  BoundedQueue<BatchItem> analyzed(queueCapacity);
+  atomic<int> nextPath(0);
+  atomic<int> decodersLeft(decodeThreads);
+  atomic<int> analyzersLeft(analyzeThreads);
+  atomic<int> failed(0);
+  atomic<long long> decodeUs(0), analyzeUs(0), encodeUs(0); // time spent in each stage, summed over its threads
+  mutex logMutex;
+
+  chrono::time_point<chrono::steady_clock> start = chrono::steady_clock::now();
+  const string suffix = maskName(lStep, aStep, bStep) + maskExtension(output.format);
+  ShadowConfig config;
+  config.lStep = lStep;
+  config.aStep = aStep;
+  config.bStep = bStep;
+  config.filter = filter;
+
+  vector<thread> threads;
+
+  // decode: read images in order of the list
+  for(int t = 0; t < decodeThreads; t++){
+    threads.push_back(thread([&]{
+      for(int p = nextPath++; p < paths.size(); p = nextPath++){
+        chrono::time_point<chrono::steady_clock> Tstart = chrono::steady_clock::now();
+        BatchItem item = {p, Mat()};
+        {
+          PROFILE_SCOPE("load");
+          item.img = imread(paths[p]);
+        }
+        decodeUs += chrono::duration_cast<chrono::microseconds> (chrono::steady_clock::now() - Tstart).count();
+
+        if(item.img.empty()){
+          failed++;
+          lock_guard<mutex> lock(logMutex);
+          cout << "Can not open " << paths[p] << ", skipped" << endl;
+          continue;
+        }
+        decoded.push(item);
+      }
+      if(--decodersLeft == 0){
+        decoded.close();
+      }
+    }));
+  }
+
+  // analyze: the images in flight share the scheduler
+  for(int t = 0; t < analyzeThreads; t++){
+    threads.push_back(thread([&]{
+      // each thread keeps its buffers across images. See ShadowDetector.cpp
+      ShadowDetector detector(config, scheduler);
+      BatchItem item;
+      while(decoded.pop(item)){
+        chrono::time_point<chrono::steady_clock> Tstart = chrono::steady_clock::now();
+        Mat mask;
+        detector.detect(item.img, mask);
+        item.img = mask;
+        analyzeUs += chrono::duration_cast<chrono::microseconds> (chrono::steady_clock::now() - Tstart).count();
+
+        analyzed.push(item);
+      }
+      if(--analyzersLeft == 0){
+        analyzed.close();
+      }
+    }));
+  }
+
+  // encode
+  for(int t = 0; t < encodeThreads; t++){
+    threads.push_back(thread([&]{
+      BatchItem item;
+      while(analyzed.pop(item)){
+        chrono::time_point<chrono::steady_clock> Tstart = chrono::steady_clock::now();
+        string dst = outDir + "/" + names[item.id] + "_" + suffix;
+        bool written = writeMask(dst, item.img, output);
+        encodeUs += chrono::duration_cast<chrono::microseconds> (chrono::steady_clock::now() - Tstart).count();
+
+        if(!written){
+          failed++;
+          lock_guard<mutex> lock(logMutex);
+          cout << "Can not write " << dst << endl;
+        }
+      }
+    }));
+  }
+
+  for(int t = 0; t < threads.size(); t++){
+    threads[t].join();
+  }
+
+  // provide information to the user
+  double seconds = chrono::duration_cast<chrono::microseconds> (chrono::steady_clock::now() - start).count() / 1e6;
+  int done = paths.size() - failed;
+  cout << "Processed " << done << " of " << paths.size() << " images in " << seconds << " s ("
+       << (seconds > 0 ? done / seconds : 0) << " images/s)" << endl;
+  cout << "Time per stage summed over threads -> decode: " << decodeUs / 1000 << " ms, analyze: "
+       << analyzeUs / 1000 << " ms, encode: " << encodeUs / 1000 << " ms" << endl;
+
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,348 @@
+/**
+ * @file Bench.cpp
+ * The goal of the code in this file is to measure speed and check correctness of the pipeline in a single run.
+ * Every image of a folder is scaled to a few resolutions and processed with a few step settings by a
+ * ShadowDetector. Each configuration is run several times: the latency of the whole pipeline and of each stage
+ * (taken from the profiler, see Profiler.cpp) are reported as median and 95th percentile, together with the
+ * throughput and the peak memory of the process.
+ * The final masks are compared with a baseline computed with the bilateral filter, which is the reference mode.
+ * With the bilateral filter they must be equal pixel by pixel; the joint and half resolution filters change the
+ * filtered planes, so their masks only need an intersection over union above a tolerance. A missing baseline is
+ * a failure, unless the baseline is being written.
+ * The masks of the sample images published in results by version 1.0 are checked too: they are JPEG files, so
+ * they only need an intersection over union above referenceIoU.
+ *
+ * @author Martini Davide
+ * @version 1.1
+ * @since 1.1
+ *
+ */
+
+#include "ShadowDetector.h"
+#include "Batch.h"
+#include "FilterCompare.h"
+#include "Sweep.h"
+
+#include <iomanip>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+const double benchScales[] = {1., 0.5, 0.25};
+const StepTriple benchSteps[] = {{20, 50, 50}, {10, 10, 10}, {40, 20, 20}};
+const char* benchStages[] = {"lab", "filter", "statistics", "mask", "binning", "labeling", "border test", "paint"};
+
+/**
+* A mask of results and the image and steps it was computed from
+*/
+struct ReferenceMask {
+  const char* file;
+  const char* image;
+  StepTriple steps;
+};
+
+const ReferenceMask referenceMasks[] = {
+  {"1_lStep55_aStep10_bStep10_stddev.jpg", "flickr-286554184_f274d171d7_o", {55, 10, 10}},
+  {"2_lStep10_aStep10_bStep10_stddev.jpg", "flickr-674078929_ad047cde0f_b", {10, 10, 10}},
+  {"3_lStep10_aStep10_bStep10_stddev.jpg", "flickr-2295970805_b4d4dcfed3_o", {10, 10, 10}},
+  {"3_lStep10_aStep20_bStep20_stddev.jpg", "flickr-2295970805_b4d4dcfed3_o", {10, 20, 20}},
+  {"4_lStep5_aStep5_bStep5_stddev.jpg", "flickr-2414073188_bb9d0774f5_b", {5, 5, 5}},
+  {"5_lStep60_aStep10_bStep10.jpg", "flickr-2881194909_bd550ed692_b", {60, 10, 10}},
+  {"6_lStep35_aStep5_bStep40.jpg", "flickr-3054476098_55fcbf9267_o", {35, 5, 40}},
+  {"7_lStep10_aStep10_bStep10_stddev.jpg", "flickr-3491036069_69d3df5e9f_o", {10, 10, 10}},
+  {"8_lStep10_aStep10_bStep10_stddev.jpg", "flickr-3962896865_ba07aaa177_b", {10, 10, 10}},
+  {"9_lStep20_aStep50_bStep50_stddev.jpg", "flickr-4159721472_c55deb37d6_b", {20, 50, 50}},
+  {"10_lStep30_aStep10_bStep10.jpg", "zhu-labelme_0068", {30, 10, 10}}
+};
+
+// JPEG artifacts on the edges of the reference masks
+const double referenceIoU = 0.99;
+
+static void printBenchUsage(){
+  cout << endl;
+  cout << "Run the benchmark by invoking it like this: " << endl;
+  cout << "   ./ShadowDet_bench [--data ../data] [--baseline ../results/baseline] [--references ../results] [--runs 5]" << endl;
+  cout << "                     [--filter bilateral|joint|half] [--iou 0.95] [--update-baseline]" << endl;
+  cout << endl;
+  cout << "--update-baseline writes the masks of the bilateral filter as the new baseline instead of checking them." << endl;
+  cout << "Without it, a configuration without baseline fails." << endl;
+  cout << "The border test runs on many threads at once, so its time is summed over threads." << endl;
+  cout << endl;
+}
+
+/**
+* Returns the value at the given fraction of the sorted values (nearest rank)
+*/
+static double percentile(vector<double> values, double fraction){
+  sort(values.begin(), values.end());
+  int rank = (int) ceil(fraction * values.size()) - 1;
+  return values[max(rank, 0)];
+}
+
+/**
+* Returns the peak resident memory of the process in megabytes
+*/
+static double peakRssMb(){
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss / 1024.; // kilobytes on Linux
+}
+
+static string baseName(const string& path){
+  size_t slash = path.find_last_of("/\\");
+  string name = (slash == string::npos) ? path : path.substr(slash + 1);
+  size_t dot = name.find_last_of('.');
+  return (dot == string::npos) ? name : name.substr(0, dot);
+}
+
+/**
+* This function computes the mask of each reference whose image is in the data folder and compares it with the
+* reference. With the bilateral filter the intersection over union must reach referenceIoU, otherwise the lower
+* of referenceIoU and the tolerance of the filter.
+*
+* @param paths images of the data folder
+* @param referenceDir folder of the reference masks
+* @param filter filter of the detectors
+* @param tolerance minimum intersection over union of the joint and half resolution filters
+* @param scheduler scheduler of the detectors
+* @param checked incremented by the number of references checked
+* @param missing incremented by the number of references that can not be read
+* @return number of failed references
+*/
+static int checkReferences(const vector<string>& paths, const string& referenceDir, FilterMode filter, double tolerance,
+    TaskScheduler& scheduler, int& checked, int& missing){
+  double minIoU = (filter == FILTER_BILATERAL) ? referenceIoU : min(referenceIoU, tolerance);
+  int failed = 0;
+  const int numReferences = sizeof(referenceMasks) / sizeof(referenceMasks[0]);
+  cout << endl << left << setw(40) << "reference" << right << setw(12) << "steps" << "  check" << endl;
+  for(int r = 0; r < numReferences; r++){
+    const ReferenceMask& reference = referenceMasks[r];
+    int p = 0;
+    while(p < paths.size() && baseName(paths[p]) != reference.image){
+      p++;
+    }
+    if(p == paths.size()){
+      continue; // the image is not part of this run
+    }
+
+    stringstream steps;
+    steps << reference.steps.lStep << "," << reference.steps.aStep << "," << reference.steps.bStep;
+    cout << left << setw(40) << reference.file << right << setw(12) << steps.str() << "  ";
+
+    Mat expected = imread(referenceDir + "/" + reference.file, IMREAD_GRAYSCALE);
+    Mat img = imread(paths[p]);
+    if(expected.empty() || img.empty()){
+      cout << "can not be read" << endl;
+      missing++;
+      continue;
+    }
+
+    ShadowConfig config;
+    config.lStep = reference.steps.lStep;
+    config.aStep = reference.steps.aStep;
+    config.bStep = reference.steps.bStep;
+    config.filter = filter;
+    ShadowDetector detector(config, scheduler);
+    Mat mask;
+    detector.detect(img, mask);
+
+    if(expected.size() != mask.size()){
+      cout << "FAIL size" << endl;
+      failed++;
+    }
+    else{
+      threshold(expected, expected, 127, 255, THRESH_BINARY);
+      double iou = maskIoU(expected, mask);
+      cout << (iou >= minIoU ? "IoU " : "FAIL IoU ") << iou << endl;
+      failed += iou < minIoU;
+    }
+    checked++;
+  }
+  return failed;
+}
+
+int main(int argc, char** argv){
+  string dataDir = "../data";
+  string baselineDir = "../results/baseline";
+  string referenceDir = "../results";
+  int runs = 5;
+  double tolerance = 0.95;
+  bool update = false;
+  FilterMode filter = FILTER_BILATERAL;
+
+  for(int a = 1; a < argc; a++){
+    string arg = argv[a];
+    bool hasValue = a + 1 < argc;
+    if(arg == "--data" && hasValue){
+      dataDir = argv[++a];
+    }
+    else if(arg == "--baseline" && hasValue){
+      baselineDir = argv[++a];
+    }
+    else if(arg == "--references" && hasValue){
+      referenceDir = argv[++a];
+    }
+    else if(arg == "--runs" && hasValue){
+      runs = atoi(argv[++a]);
+    }
+    else if(arg == "--iou" && hasValue){
+      tolerance = atof(argv[++a]);
+    }
+    else if(arg == "--filter" && hasValue && parseFilterMode(argv[a + 1], filter)){
+      a++;
+    }
+    else if(arg == "--update-baseline"){
+      update = true;
+    }
+    else{
+      printBenchUsage();
+      return 1;
+    }
+  }
+
+  vector<string> paths;
+  if(runs <= 0 || !listImages(dataDir, paths)){
+    cout << "Wrong argument! The number of runs must be positive and the data folder must contain images." << endl;
+    printBenchUsage();
+    return 1;
+  }
+  if(update && filter != FILTER_BILATERAL){
+    cout << "Wrong argument! The baseline can only be written with the bilateral filter." << endl;
+    return 1;
+  }
+  if(update){
+    mkdir(baselineDir.c_str(), 0755);
+  }
+
+  // stages are measured by the profiler. The per bin log would disturb the measures
+  setProfiling(true);
+  setVerbose(false);
+
+  TaskScheduler scheduler;
+  const int numSteps = sizeof(benchSteps) / sizeof(benchSteps[0]);
+  const int numScales = sizeof(benchScales) / sizeof(benchScales[0]);
+  const int numStages = sizeof(benchStages) / sizeof(benchStages[0]);
+
+  // one detector per step setting, so that buffers are reused as they would be in a service
+  vector<unique_ptr<ShadowDetector> > detectors;
+  for(int s = 0; s < numSteps; s++){
+    ShadowConfig config;
+    config.lStep = benchSteps[s].lStep;
+    config.aStep = benchSteps[s].aStep;
+    config.bStep = benchSteps[s].bStep;
+    config.filter = filter;
+    detectors.push_back(unique_ptr<ShadowDetector>(new ShadowDetector(config, scheduler)));
+  }
+
+  cout << "Threads: " << scheduler.size() << ", images: " << paths.size() << ", runs: " << runs << ", filter: "
+       << filterModeName(filter) << endl << endl;
+  cout << left << setw(40) << "image" << right << setw(6) << "scale" << setw(12) << "steps" << setw(12) << "size"
+       << setw(10) << "p50 ms" << setw(10) << "p95 ms" << setw(10) << "MP/s" << "  check" << endl;
+
+  int checked = 0, failed = 0, missing = 0;
+  double totalPixels = 0, totalMs = 0;
+  for(int p = 0; p < paths.size(); p++){
+    Mat original = imread(paths[p]);
+    if(original.empty()){
+      cout << "Can not open " << paths[p] << ", skipped" << endl;
+      continue;
+    }
+
+    for(int k = 0; k < numScales; k++){
+      Mat img;
+      if(benchScales[k] == 1.){
+        img = original;
+      }
+      else{
+        resize(original, img, Size(), benchScales[k], benchScales[k], INTER_AREA);
+      }
+
+      for(int s = 0; s < numSteps; s++){
+        ShadowDetector& detector = *detectors[s];
+        Mat mask;
+
+        // the first run allocates the buffers and is not measured
+        detector.detect(img, mask);
+        vector<double> latencies;
+        vector<vector<double> > stageMs(numStages);
+        for(int r = 0; r < runs; r++){
+          resetProfile();
+          chrono::time_point<chrono::steady_clock> start = chrono::steady_clock::now();
+          detector.detect(img, mask);
+          latencies.push_back(chrono::duration_cast<chrono::microseconds> (chrono::steady_clock::now() - start).count() / 1000.);
+
+          map<string, long long> totals;
+          stageTotals(totals);
+          for(int g = 0; g < numStages; g++){
+            stageMs[g].push_back(totals[benchStages[g]] / 1000.);
+          }
+        }
+
+        // check the mask against the baseline
+        stringstream sstm;
+        sstm << baselineDir << "/" << baseName(paths[p]) << "_x" << (int) (benchScales[k] * 100) << "_" << benchSteps[s].lStep
+             << "_" << benchSteps[s].aStep << "_" << benchSteps[s].bStep << ".png";
+        string check;
+        if(update){
+          check = imwrite(sstm.str(), mask) ? "written" : "not written";
+        }
+        else{
+          Mat baseline = imread(sstm.str(), IMREAD_GRAYSCALE);
+          if(baseline.empty()){
+            check = "FAIL no baseline";
+            missing++;
+          }
+          else if(baseline.size() != mask.size()){
+            check = "FAIL size";
+            failed++;
+          }
+          else if(filter == FILTER_BILATERAL){
+            Mat different;
+            compare(baseline, mask, different, CMP_NE);
+            int diff = countNonZero(different);
+            check = (diff == 0) ? "exact" : "FAIL " + to_string(diff) + " pixels";
+            failed += diff != 0;
+          }
+          else{
+            double iou = maskIoU(baseline, mask);
+            check = (iou >= tolerance ? "IoU " : "FAIL IoU ") + to_string(iou);
+            failed += iou < tolerance;
+          }
+          checked++;
+        }
+
+        // provide information to the user
+        double p50 = percentile(latencies, 0.5);
+        double megapixels = img.total() / 1e6;
+        totalPixels += megapixels * runs;
+        for(int r = 0; r < runs; r++){
+          totalMs += latencies[r];
+        }
+
+        stringstream steps, size;
+        steps << benchSteps[s].lStep << "," << benchSteps[s].aStep << "," << benchSteps[s].bStep;
+        size << img.cols << "x" << img.rows;
+        cout << left << setw(40) << baseName(paths[p]) << right << setw(6) << benchScales[k] << setw(12) << steps.str()
+             << setw(12) << size.str() << fixed << setprecision(2) << setw(10) << p50 << setw(10)
+             << percentile(latencies, 0.95) << setw(10) << megapixels * 1000 / p50 << "  " << check << endl;
+        cout << "      stages p50/p95 ms:";
+        for(int g = 0; g < numStages; g++){
+          cout << " " << benchStages[g] << " " << percentile(stageMs[g], 0.5) << "/" << percentile(stageMs[g], 0.95);
+        }
+        cout << endl;
+        cout.unsetf(ios::fixed);
+        cout << setprecision(6);
+      }
+    }
+  }
+
+  double throughput = totalPixels * 1000 / totalMs;
+  if(!update){
+    failed += checkReferences(paths, referenceDir, filter, tolerance, scheduler, checked, missing);
+  }
+
+  cout << endl << "Throughput: " << throughput << " MP/s, peak RSS: " << peakRssMb() << " MB" << endl;
+  if(!update){
+    cout << "Masks checked: " << checked << ", failed: " << failed << ", without baseline: " << missing << endl;
+  }
+  return (failed == 0 && missing == 0) ? 0 : 1;
+}
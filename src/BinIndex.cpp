@@ -0,0 +1,126 @@
+/**
+ * @file BinIndex.cpp
+ * The goal of the code in this file is to assign each pixel to its color bin and to
+ * group the pixels of the mask by bin. The bin image is computed with lookup tables
+ * instead of per-pixel divisions, and pixels are bucketed with a counting sort into
+ * a single buffer, so that no allocation or tree lookup is done per pixel.
+ *
+ * @author Martini Davide
+ * @version 1.1
+ * @since 1.1
+ *
+ */
+
+#include "BinIndex.h"
+#include "FrontEndKernels.h"
+
+/**
+* This function fills the lookup tables used to compute the bin of a pixel.
+*
+* @param lStep step used to group l* components. It must be positive
+* @param aStep step used to group a* components. It must be positive
+* @param bStep step used to group b* components. It must be positive
+* @param layout output bin layout
+*/
+void makeBinLayout(int lStep, int aStep, int bStep, BinLayout& layout){
+  CV_Assert(lStep > 0 && aStep > 0 && bStep > 0);
+
+  layout.lStep = lStep;
+  layout.aStep = aStep;
+  layout.bStep = bStep;
+  layout.nL = 255 / lStep + 1;
+  layout.nA = 255 / aStep + 1;
+  layout.nB = 255 / bStep + 1;
+
+  // steps above 255 put every value in bin 0, so they can be clamped
+  layout.mulL = (65536 + min(lStep, 256) - 1) / min(lStep, 256);
+  layout.mulA = (65536 + min(aStep, 256) - 1) / min(aStep, 256);
+  layout.mulB = (65536 + min(bStep, 256) - 1) / min(bStep, 256);
+
+  for(int v = 0; v < 256; v++){
+    layout.lutL[v] = v / lStep;
+    layout.lutA[v] = (v / aStep) * layout.nB * layout.nL;
+    layout.lutB[v] = (v / bStep) * layout.nL;
+  }
+}
+
+/**
+* This function computes the bin of every pixel of the image.
+*
+* @param imgL l* component of the filtered input image
+* @param imgA a* component of the filtered input image
+* @param imgB b* component of the filtered input image
+* @param layout bin layout. See makeBinLayout()
+* @param binImg output CV_32SC1 image with the bin of each pixel
+*/
+void quantizeBins(const Mat& imgL, const Mat& imgA, const Mat& imgB, const BinLayout& layout, Mat& binImg){
+  binImg.create(imgL.size(), CV_32SC1);
+
+  // See FrontEndKernels.cpp
+  for(int i = 0; i < imgL.rows; i++){
+    quantizeRow(imgL.ptr<uchar>(i), imgA.ptr<uchar>(i), imgB.ptr<uchar>(i), imgL.cols, layout, binImg.ptr<int>(i));
+  }
+}
+
+/**
+* This function buckets the pixels of the mask by bin with a counting sort. The first pass counts
+* the pixels of each bin, the second one writes each pixel at the next free slot of its bin.
+*
+* @param binImg CV_32SC1 image with the bin of each pixel. See quantizeBins()
+* @param mask CV_8UC1 image. Only pixels different from zero are indexed
+* @param layout bin layout used to compute binImg
+* @param index output bin index
+*/
+void buildBinIndex(const Mat& binImg, const Mat& mask, const BinLayout& layout, BinIndex& index){
+  CV_Assert(binImg.type() == CV_32SC1 && mask.type() == CV_8UC1 && binImg.size() == mask.size());
+
+  vector<int>& counts = index.counts;
+  counts.resize(layout.nL * layout.nA * layout.nB, 0);
+  index.bins.clear();
+
+  // count the pixels of each bin and collect the occupied ones
+  int total = 0;
+  for(int i = 0; i < binImg.rows; i++){
+    const int* bin = binImg.ptr<int>(i);
+    const uchar* m = mask.ptr<uchar>(i);
+    for(int j = 0; j < binImg.cols; j++){
+      if(m[j] != 0){
+        if(counts[bin[j]] == 0){
+          index.bins.push_back(bin[j]);
+        }
+        counts[bin[j]]++;
+        total++;
+      }
+    }
+  }
+  sort(index.bins.begin(), index.bins.end());
+
+  // turn counts into the first free slot of each bin
+  index.offsets.resize(index.bins.size() + 1);
+  int offset = 0;
+  for(int k = 0; k < (int) index.bins.size(); k++){
+    int count = counts[index.bins[k]];
+    index.offsets[k] = offset;
+    counts[index.bins[k]] = offset;
+    offset += count;
+  }
+  index.offsets[index.bins.size()] = offset;
+
+  // scatter pixels. Rows are visited in order, so each bucket is in raster order
+  index.pixels.resize(total);
+  for(int i = 0; i < binImg.rows; i++){
+    const int* bin = binImg.ptr<int>(i);
+    const uchar* m = mask.ptr<uchar>(i);
+    int rowStart = i * binImg.cols;
+    for(int j = 0; j < binImg.cols; j++){
+      if(m[j] != 0){
+        index.pixels[counts[bin[j]]++] = rowStart + j;
+      }
+    }
+  }
+
+  // leave the counters to zero for the next call
+  for(int k = 0; k < (int) index.bins.size(); k++){
+    counts[index.bins[k]] = 0;
+  }
+}
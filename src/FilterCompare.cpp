@@ -0,0 +1,130 @@
+/**
+ * @file FilterCompare.cpp
+ * The goal of the code in this file is to compare the filter modes on a set of images, so
+ * that the mode of a deployment can be chosen knowing what it costs and what it gives.
+ * For every image and mode the time of the filter and of the whole front end is measured,
+ * and the result is compared with the reference mode (FILTER_BILATERAL): PSNR of the filtered
+ * planes and intersection over union of the final masks.
+ *
+ * @author Martini Davide
+ * @version 1.1
+ * @since 1.1
+ *
+ */
+
+#include "FilterCompare.h"
+
+#include <iomanip>
+
+// every measure is the median of this many runs
+const int compareRuns = 3;
+
+static double elapsedMs(const chrono::time_point<chrono::steady_clock>& from){
+  return chrono::duration_cast<chrono::microseconds> (chrono::steady_clock::now() - from).count() / 1000.;
+}
+
+static double median(vector<double> values){
+  sort(values.begin(), values.end());
+  return values[values.size() / 2];
+}
+
+/**
+* Returns the intersection over union of two binary masks. Two empty masks are equal
+*/
+double maskIoU(const Mat& a, const Mat& b){
+  Mat both, any;
+  bitwise_and(a, b, both);
+  bitwise_or(a, b, any);
+  int unionPixels = countNonZero(any);
+  return unionPixels == 0 ? 1. : (double) countNonZero(both) / unionPixels;
+}
+
+/**
+* This function runs the comparison and prints one line per image and mode, followed by the averages of each mode.
+*
+* @param paths input image paths
+* @param lStep step used to group l* components. It must be positive
+* @param aStep step used to group a* components. It must be positive
+* @param bStep step used to group b* components. It must be positive
+* @param scheduler pool of threads used by detectShadows(). See TaskScheduler.cpp for more details
+* @return 0 on success, 1 if an image can not be opened
+*/
+int compareFilters(const vector<string>& paths, int lStep, int aStep, int bStep, TaskScheduler& scheduler){
+  const FilterMode modes[] = {FILTER_BILATERAL, FILTER_JOINT, FILTER_HALF};
+  const int numModes = sizeof(modes) / sizeof(modes[0]);
+
+  BinLayout layout;
+  makeBinLayout(lStep, aStep, bStep, layout);
+
+  vector<double> sumFilterMs(numModes, 0), sumFrontEndMs(numModes, 0), sumPsnr(numModes, 0), sumIoU(numModes, 0);
+  int images = 0;
+  int failed = 0;
+
+  cout << fixed << setprecision(2);
+  cout << "image, mode -> filter ms, front end ms, PSNR L/A/B (dB), mask IoU" << endl;
+
+  for(int p = 0; p < paths.size(); p++){
+    Mat imgRGB = imread(paths[p]);
+    if(imgRGB.empty()){
+      cout << "Can not open " << paths[p] << ", skipped" << endl;
+      failed++;
+      continue;
+    }
+
+    Mat imgLAB;
+    cvtColor(imgRGB, imgLAB, COLOR_RGB2Lab);
+
+    FrontEnd reference;
+    Mat referenceMask;
+    for(int m = 0; m < numModes; m++){
+      vector<double> filterMs, frontEndMs;
+      Mat imgL, imgA, imgB;
+      FrontEnd fe;
+      for(int run = 0; run < compareRuns; run++){
+        chrono::time_point<chrono::steady_clock> start = chrono::steady_clock::now();
+        filterLab(imgLAB, modes[m], imgL, imgA, imgB);
+        filterMs.push_back(elapsedMs(start));
+
+        start = chrono::steady_clock::now();
+        computeFrontEnd(imgRGB, fe, &layout, modes[m]);
+        frontEndMs.push_back(elapsedMs(start));
+      }
+
+      Mat mask;
+      detectShadows(fe, lStep, aStep, bStep, scheduler, mask);
+      if(m == 0){
+        reference = fe;
+        referenceMask = mask;
+      }
+
+      // PSNR is infinite for identical planes, report it as 99 dB
+      double psnr[3];
+      const Mat* planes[3] = {&fe.imgL, &fe.imgA, &fe.imgB};
+      const Mat* refPlanes[3] = {&reference.imgL, &reference.imgA, &reference.imgB};
+      for(int c = 0; c < 3; c++){
+        psnr[c] = norm(*planes[c], *refPlanes[c], NORM_L1) == 0 ? 99. : PSNR(*planes[c], *refPlanes[c]);
+      }
+      double iou = maskIoU(mask, referenceMask);
+
+      cout << paths[p] << ", " << filterModeName(modes[m]) << " -> " << median(filterMs) << ", " << median(frontEndMs)
+           << ", " << psnr[0] << "/" << psnr[1] << "/" << psnr[2] << ", " << iou << endl;
+
+      sumFilterMs[m] += median(filterMs);
+      sumFrontEndMs[m] += median(frontEndMs);
+      sumPsnr[m] += (psnr[0] + psnr[1] + psnr[2]) / 3;
+      sumIoU[m] += iou;
+    }
+    images++;
+  }
+
+  if(images > 0){
+    cout << endl << "mode -> mean filter ms, mean front end ms, mean PSNR (dB), mean mask IoU, filter speedup" << endl;
+    for(int m = 0; m < numModes; m++){
+      cout << filterModeName(modes[m]) << " -> " << sumFilterMs[m] / images << ", " << sumFrontEndMs[m] / images
+           << ", " << sumPsnr[m] / images << ", " << sumIoU[m] / images << ", "
+           << (sumFilterMs[m] > 0 ? sumFilterMs[0] / sumFilterMs[m] : 0) << "x" << endl;
+    }
+  }
+
+  return failed == 0 ? 0 : 1;
+}
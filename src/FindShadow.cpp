@@ -2,9 +2,12 @@
  * @file FindShadow.cpp
  * The goal of the code in this file is to provide the implementation of
  * findShadow() function. Since it is called concurrently by multiple threads
- * mutex are introduced to sincronyze access to shared resources. In particular,
- * these are the standard output and the vector of points that collects the shadow
- * pixels.
+ * a mutex is introduced to sincronyze access to the standard output, which is
+ * used only in verbose mode. Each call writes the decisions of its own range of
+ * components, so results are collected without locks and the mask is painted
+ * afterwards by paintShadows().
+ * Connected components are computed once for the whole image by labelBins(),
+ * so no lock is needed around the labeling anymore.
  *
  * @author Martini Davide
  * @version 1.0
@@ -14,134 +17,222 @@
 
 #include "FindShadow.h"
 
-mutex ccMutex; // mutex used to make connectedComponents() thread safe
-mutex spMutex; // mutex used to protect access to shadowPoints
-mutex printMutex; // mutex used to protect access to standard output
+static mutex printMutex; // mutex used to protect access to standard output
 
 /**
-* This function examines a set of pixels with common l*a*b* components and returns the ones that belong to a shadow.
-* At first, connected components are extracted and then each one is analyzed to state if it is a shadow or not.
-* In order to do this, this function computes the border of each patch. Then it looks for a border pixels with a* and b*
-* equal as those of the component, but with higher lightnes value. If such a pixel is found, then the component is
-* a shadow patch and all its pixels are returned as shadow pixels.
+* Scratch memory of a thread. Runs are visited in row order, so the border pixels of the current run lie on
+* three consecutive rows and a row is never visited again once the runs have moved two rows past it.
+* stamps holds three rows as wide as the bounding box (plus one pixel) of the component, image row x being
+* stored in slot x % 3. A pixel has already been examined if its stamp equals the generation of its slot,
+* which is renewed every time the slot is given a new row, so the buffer never needs to be cleared and
+* only grows to three rows of the widest bounding box seen by the thread
+*/
+struct ScratchArena {
+  vector<unsigned int> stamps;
+  unsigned int generation;
+};
+
+static thread_local ScratchArena arena = {vector<unsigned int>(), 0};
+
+/**
+* This function visits the border of a component, i.e. the 8-neighbours of its pixels that do not lie on the
+* image border, and stops at the first one whose bin has the same a*, b* values as the component but higher
+* lightness. Only three rows of the width of the bounding box are used as scratch, see ScratchArena.
 *
-* @param imgL l* component of the filtered input image
-* @param imgA a* component of the filtered input image
-* @param imgB b* component of the filtered input image
-* @param labValues l*, a*, b* values of all pixels in the provided components
-* @param labPixels vector of points (i, j) with equal l*, a*, b* values
-* @param lStep step used to group l* components. See Main.cpp for more details
-* @param aStep step used to group a* components. See Main.cpp for more details
-* @param bStep step used to group b* components. See Main.cpp for more details
-* @param shadowPoints vector used to store shadow pixels. It is shared by threads that call this function. See Main.cpp for more details
+* @param binImg bin of each pixel of the filtered input image
+* @param cs connected components of the whole image
+* @param comp component to analyze
+* @param runBegin index in cs.runs of the first run of comp to visit
+* @param runEnd index in cs.runs after the last run of comp to visit
+* @param lighterRange number of bins lighter than the component with its same a*, b* values
+* @param examined incremented by the number of border pixels examined
+* @return true if such a border pixel exists
 */
-void findShadow(Mat imgL, Mat imgA, Mat imgB, tuple<int, int, int> labValues,
-    vector<Point> labPixels, int lStep, int aStep, int bStep, vector<Point>& shadowPoints){
+static bool hasLighterBorder(const Mat& binImg, const ComponentSet& cs, const BinComponent& comp, int runBegin, int runEnd,
+    unsigned int lighterRange, long long& examined){
 
-  // measure elapsed time to perform the procedure
-  chrono::time_point<chrono::system_clock> Tstart, Tend;
-  Tstart = chrono::system_clock::now();
+  // columns of the image where border pixels can lie
+  const int x0 = max(comp.bbox.x - 1, 0);
+  const int x1 = min(comp.bbox.x + comp.bbox.width + 1, binImg.cols);
+  const int roiCols = x1 - x0;
 
-  // compute all connected components. See https://docs.opencv.org/3.4.3/d3/dc0/group__imgproc__shape.html
-  Mat temp = Mat_<uchar>::zeros(imgL.size());
-  for (int w = 0; w < labPixels.size(); w++){
-    Point p = labPixels[w];
-    temp.at<uchar> (p.x, p.y) = 255;
+  if(arena.stamps.size() < 3 * (size_t) roiCols){
+    arena.stamps.resize(3 * (size_t) roiCols, 0);
   }
+  unsigned int* stamps = arena.stamps.data();
+  int slotRow[3] = {-1, -1, -1}; // image row held by each slot
+  unsigned int slotGen[3] = {0, 0, 0};
+  const int bin = comp.bin;
+
+  for(int r = runBegin; r < runEnd; r++){
+    const Run& run = cs.runs[r];
+    const int i = run.row;
+
+    // pixels on the image border have no border pixels
+    const int jBegin = max(run.colBegin, 1);
+    const int jEnd = min(run.colEnd, binImg.cols - 1);
+    if(i == 0 || i == binImg.rows - 1 || jBegin >= jEnd){
+      continue;
+    }
 
-  Mat labLabels;
-  ccMutex.lock(); // connectedComponents() is itself multithreaded and not thread safe
-  int labComp = connectedComponents(temp, labLabels);
-  ccMutex.unlock();
-  temp.release();
-
-  // retrieve each component's pixels and store them separately for further computation
-  vector<vector<Point> > labCComps;
-  for (int cc = 1; cc < labComp; cc++){ // cc = 0 represents the black background
-    vector<Point> labCompPixels; // store pixels in the current component
-
-    // collect pixels
-    for(int i = 0; i < labLabels.rows; i++){
-      for(int j = 0; j < labLabels.cols; j++){
-        if(labLabels.at<int> (i,j) == cc){
-          labCompPixels.push_back(Point(i,j));
+    // neighbours of [jBegin, jEnd) are columns [jBegin - 1, jEnd] of the rows above and below,
+    // and the two pixels at the ends of the run on its own row
+    for(int x = i - 1; x <= i + 1; x++){
+      const int* binRow = binImg.ptr<int>(x);
+      const int slot = x % 3;
+      if(slotRow[slot] != x){
+        slotRow[slot] = x;
+        if(++arena.generation == 0){
+          fill(arena.stamps.begin(), arena.stamps.end(), 0);
+          arena.generation = 1;
         }
+        slotGen[slot] = arena.generation;
       }
-    }
-
-    labCComps.push_back(labCompPixels);
-  }
-
-  int pixelCounter = 0; // only used to output information to the user
+      const unsigned int gen = slotGen[slot];
+      unsigned int* stampRow = stamps + (size_t) slot * roiCols;
+      for(int y = jBegin - 1; y <= jEnd; y++){
+        if(x == i && y == jBegin){
+          y = jEnd; // skip the pixels of the run itself
+        }
+        if(stampRow[y - x0] != gen){
+          stampRow[y - x0] = gen;
+          examined++;
 
-  // for each connected component, define if it is a shadow or not
-  for(int labCC = 0; labCC < labCComps.size(); labCC++){
-    vector<Point> labCompPixels = labCComps[labCC];
-    vector<Point> border;
-    Mat supportBorder = Mat_<uchar>::zeros(imgL.size()); // used to avoid duplicates in border
-    Mat temp = Mat_<uchar>::zeros(imgL.size());
-    pixelCounter = pixelCounter + labCompPixels.size();
-
-    // retrieve border pixels
-    for(int w = 0; w < labCompPixels.size(); w++){
-      Point p = labCompPixels[w];
-      int i = p.x;
-      int j = p.y;
-      temp.at<uchar>(i, j) = 1;
-      if(i != 0 && j != 0 && i != (imgL.rows - 1) && j != (imgL.cols - 1)){
-        for(int x = -1; x <= 1; x++){
-          for(int y = -1; y <= 1; y++){
-            if(y == 0 && x == 0){
-              continue;
-            }
-            else{
-              if(supportBorder.at<uchar> (i+x,j+y) == 0){
-                border.push_back(Point(i+x,j+y));
-                supportBorder.at<uchar> (i+x,j+y) = 255;
-              }
-            }
+          // bp is lighter than the component but has same color of the component
+          if((unsigned int) (binRow[y] - bin - 1) < lighterRange){
+            return true;
           }
         }
       }
     }
+  }
+
+  return false;
+}
+
+/**
+* This function states if a single component is a shadow. See findShadow().
+*
+* @param binImg bin of each pixel of the filtered input image
+* @param layout bin layout used to compute binImg
+* @param cs connected components of the image
+* @param c index of the component in cs.comps
+* @return true if the component is a shadow
+*/
+bool isShadowComponent(const Mat& binImg, const BinLayout& layout, const ComponentSet& cs, int c){
+  const BinComponent& comp = cs.comps[c];
+  const int compL = binL(layout, comp.bin);
+  long long examined = 0;
+  return compL > 0 && hasLighterBorder(binImg, cs, comp, comp.firstRun, comp.firstRun + comp.numRuns,
+      layout.nL - compL - 1, examined);
+}
+
+/**
+* This function runs the border test of findShadow() over a part of a component. A component is a shadow if
+* any of its parts is, so a component much larger than the others can be analyzed by several threads.
+*
+* @param binImg bin of each pixel of the filtered input image
+* @param layout bin layout used to compute binImg
+* @param cs connected components of the image
+* @param c index of the component in cs.comps. Its lightness bin must be positive
+* @param runBegin index in cs.runs of the first run of the part
+* @param runEnd index in cs.runs after the last run of the part
+* @return true if a border pixel of the part has the same a*, b* values of the component but higher lightness
+*/
+bool isShadowPart(const Mat& binImg, const BinLayout& layout, const ComponentSet& cs, int c, int runBegin, int runEnd){
+  PROFILE_SCOPE("border test");
+  const BinComponent& comp = cs.comps[c];
+  long long examined = 0;
+  bool found = hasLighterBorder(binImg, cs, comp, runBegin, runEnd, layout.nL - binL(layout, comp.bin) - 1, examined);
+  addCounter(COUNTER_BORDER_PIXELS, examined);
+  return found;
+}
+
+/**
+* This function examines a set of connected components with common l*a*b* components and returns the ones that belong to a shadow.
+* Components are extracted beforehand by labelBins() (see LabelBins.cpp), so this function only analyzes each one to state
+* if it is a shadow or not. In order to do this, this function computes the border of each patch. Then it looks for a border
+* pixels with a* and b* equal as those of the component, but with higher lightnes value. If such a pixel is found, then
+* the component is a shadow patch and it is marked as such in shadow.
+* The analysis of a component is local to its bounding box and uses the scratch memory of the calling thread,
+* so it does not allocate and its cost does not depend on the size of the image.
+*
+* @param binImg bin of each pixel of the filtered input image. See BinIndex.cpp for more details
+* @param layout bin layout used to compute binImg
+* @param cs connected components of the whole image. See LabelBins.cpp for more details
+* @param compBegin index of the first component in cs.comps to analyze. All components in the range must have the same bin
+* @param compEnd index after the last component in cs.comps to analyze
+* @param shadow decision of each component of cs, 1 for shadows and 0 otherwise. Threads that call this function
+* share it, but each one writes only the entries of its range
+*/
+void findShadow(const Mat& binImg, const BinLayout& layout, const ComponentSet& cs, int compBegin, int compEnd,
+    vector<uchar>& shadow){
+
+  PROFILE_SCOPE("border test");
+
+  // measure elapsed time to perform the procedure
+  chrono::time_point<chrono::system_clock> Tstart, Tend;
+  Tstart = chrono::system_clock::now();
+
+  // bins with the same a*, b* values and higher lightness than the components are the ones in
+  // (bin, bin + lighterRange]. A component with the lowest lightness bin can not be a shadow
+  const int bin = cs.comps[compBegin].bin;
+  const int compL = binL(layout, bin);
+  const unsigned int lighterRange = layout.nL - compL - 1;
 
-    supportBorder.release();
+  int pixelCounter = 0; // only used to output information to the user
+  long long examined = 0;
+  int shadows = 0;
+
+  // for each connected component, define if it is a shadow or not
+  for(int labCC = compBegin; labCC < compEnd; labCC++){
+    const BinComponent& comp = cs.comps[labCC];
+    pixelCounter = pixelCounter + comp.area;
 
     // look at border pixels:
     // 1) if there is a pixel with higher lightness than the component but equal chromatic values, it means
     //    that the component is a shadow that lies on a uniform background
     // 2) othrewise it is an object
-    bool isShadow = false;
-    for (int w = 0; w < border.size(); w++){
-      Point bp = border[w];
-      int bpL = ceil(imgL.at<uchar>(bp.x, bp.y) / lStep);
-      int bpA = ceil(imgA.at<uchar> (bp.x, bp.y) / aStep);
-      int bpB = ceil(imgB.at<uchar> (bp.x, bp.y) / bStep);
-
-      // bp is lighter than the component (or zero in the temporary mask) but has same color of the component
-      if(bpL > get<0>(labValues) && get<0>(labValues) > 0 && bpA == get<1>(labValues) && bpB == get<2>(labValues)){
-        isShadow = true;
-        break;
-      }
-    }
-
-    if(isShadow){
-      // write shadow pixels in the common container
-      spMutex.lock();
-      for (int w = 0; w < labCompPixels.size(); w++){
-        Point p = labCompPixels[w];
-        shadowPoints.push_back(p);
-      }
-      spMutex.unlock();
-    }
+    shadow[labCC] = compL > 0 && hasLighterBorder(binImg, cs, comp, comp.firstRun, comp.firstRun + comp.numRuns,
+        lighterRange, examined);
+    shadows += shadow[labCC];
   }
 
-  // provide information to the user
-  Tend = chrono::system_clock::now();
-  int Telapsed_seconds = chrono::duration_cast<std::chrono::milliseconds> (Tend-Tstart).count();
+  // the border test stops at the first lighter pixel, and components of the darkest bins are not visited at all
+  addCounter(COUNTER_BORDER_PIXELS, examined);
+  addCounter(COUNTER_SHADOW_COMPONENTS, shadows);
+  addCounter(COUNTER_EARLY_EXITS, compL > 0 ? shadows : compEnd - compBegin);
+
+  // provide information to the user. One line per task is printed only in verbose mode, since
+  // with thousands of bins the lock on the standard output slows down the threads
+  if(verboseEnabled()){
+    Tend = chrono::system_clock::now();
+    int Telapsed_seconds = chrono::duration_cast<std::chrono::milliseconds> (Tend-Tstart).count();
+
+    printMutex.lock();
+    cout << "Bin (" << compL << ", " << binA(layout, bin) << ", " << binB(layout, bin)
+    << ") -> totPixels: " << pixelCounter << ", totCC: " << compEnd - compBegin << ". Done in " << Telapsed_seconds << " ms" << endl;
+    printMutex.unlock();
+  }
+}
 
-  printMutex.lock();
-  cout << "Bin (" << get<0>(labValues) << ", " << get<1>(labValues) << ", " << get<2>(labValues)
-  << ") -> totPixels: " << pixelCounter << ", totCC: " << labCComps.size() << ". Done in " << Telapsed_seconds << " ms" << endl;
-  printMutex.unlock();
+/**
+* This function paints the mask in a single pass over the runs of the shadow components.
+*
+* @param cs connected components of the whole image
+* @param shadow decision of each component, as written by findShadow()
+* @param mask CV_8UC1 mask set to 0. The pixels of each shadow component are set to 255
+*/
+void paintShadows(const ComponentSet& cs, const vector<uchar>& shadow, Mat& mask){
+  PROFILE_SCOPE("paint");
+  for(int c = 0; c < cs.comps.size(); c++){
+    if(!shadow[c]){
+      continue;
+    }
+    const BinComponent& comp = cs.comps[c];
+    for(int r = comp.firstRun; r < comp.firstRun + comp.numRuns; r++){
+      const Run& run = cs.runs[r];
+      memset(mask.ptr<uchar>(run.row) + run.colBegin, 255, run.colEnd - run.colBegin);
+    }
+  }
 }
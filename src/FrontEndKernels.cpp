@@ -0,0 +1,311 @@
+/**
+ * @file FrontEndKernels.cpp
+ * The goal of the code in this file is to provide the per-pixel kernels of the front end:
+ * the lightness histogram used to compute mean and standard deviation, the PSP mask and
+ * the bin of each pixel. On x86 mask and bins are computed with AVX2 when the processor
+ * running the code supports it and with SSE2 otherwise, so the same binary runs on any
+ * machine. A scalar fallback handles the last pixels of each row and other architectures.
+ * All kernels work on 8 bit planes, no floating point copy of the image is made.
+ *
+ * @author Martini Davide
+ * @version 1.1
+ * @since 1.1
+ *
+ */
+
+#include "FrontEndKernels.h"
+
+#include <cmath>
+
+// the AVX2 kernel is compiled for its own target and selected at run time. See selectKernel()
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNELS_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+typedef int (*MaskAndBinsKernel)(const uchar* l, const uchar* a, const uchar* b, int n, int threshold,
+    const BinLayout& layout, uchar* mask, int* bin, int& done);
+
+static const BinLayout unusedLayout = BinLayout(); // passed to the kernels when bins are not computed
+
+/**
+* This function accumulates the histogram of the lightness plane. Four partial histograms are used so that
+* consecutive equal values do not stall on the same counter.
+*
+* @param imgL CV_8UC1 lightness plane
+* @param hist output histogram
+*/
+void lightnessHistogram(const Mat& imgL, int hist[256]){
+  CV_Assert(imgL.type() == CV_8UC1);
+
+  vector<int> partial(4 * 256, 0);
+  int* h0 = &partial[0];
+  int* h1 = h0 + 256;
+  int* h2 = h1 + 256;
+  int* h3 = h2 + 256;
+
+  for(int i = 0; i < imgL.rows; i++){
+    const uchar* l = imgL.ptr<uchar>(i);
+    int j = 0;
+    for(; j + 4 <= imgL.cols; j += 4){
+      h0[l[j]]++;
+      h1[l[j + 1]]++;
+      h2[l[j + 2]]++;
+      h3[l[j + 3]]++;
+    }
+    for(; j < imgL.cols; j++){
+      h0[l[j]]++;
+    }
+  }
+
+  for(int v = 0; v < 256; v++){
+    hist[v] = h0[v] + h1[v] + h2[v] + h3[v];
+  }
+}
+
+/**
+* This function computes mean and standard deviation of the lightness from its histogram. Sums are exact
+* integers, so the result is the same given by meanStdDev() on the plane.
+*
+* @param hist lightness histogram. See lightnessHistogram()
+* @param meanL output mean
+* @param stdDevL output standard deviation
+*/
+void lightnessStats(const int hist[256], double& meanL, double& stdDevL){
+  long long count = 0;
+  long long sum = 0;
+  long long sqSum = 0;
+  for(int v = 0; v < 256; v++){
+    count += hist[v];
+    sum += (long long) hist[v] * v;
+    sqSum += (long long) hist[v] * v * v;
+  }
+
+  if(count == 0){
+    meanL = 0;
+    stdDevL = 0;
+    return;
+  }
+
+  double scale = 1. / count;
+  meanL = sum * scale;
+  stdDevL = sqrt(max(sqSum * scale - meanL * meanL, 0.));
+}
+
+/**
+* Returns the integer t such that an 8 bit lightness l is below threshold if and only if l < t
+*/
+int lightnessThreshold(double threshold){
+  return (int) min(max(ceil(threshold), 0.), 255.);
+}
+
+/**
+* Scalar version of maskAndBinsRow(). Either mask or bin can be null
+*/
+static int maskAndBinsScalar(const uchar* l, const uchar* a, const uchar* b, int n, int threshold,
+    const BinLayout& layout, uchar* mask, int* bin){
+  int count = 0;
+  for(int j = 0; j < n; j++){
+    if(mask != 0){
+      bool psp = l[j] < threshold;
+      mask[j] = psp ? 1 + l[j] : 0;
+      count += psp;
+    }
+    if(bin != 0){
+      bin[j] = layout.lutA[a[j]] + layout.lutB[b[j]] + layout.lutL[l[j]];
+    }
+  }
+  return count;
+}
+
+#if defined(KERNELS_AVX2)
+
+// 8 pixels: v / step is (v * mul) >> 16, then bin = (a * nB + b) * nL + l
+__attribute__((target("avx2")))
+static inline __m256i quantize8(const uchar* l, const uchar* a, const uchar* b, const __m256i& mulL,
+    const __m256i& mulA, const __m256i& mulB, const __m256i& nB, const __m256i& nL){
+  __m256i ql = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) l)), mulL), 16);
+  __m256i qa = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) a)), mulA), 16);
+  __m256i qb = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) b)), mulB), 16);
+  return _mm256_add_epi32(_mm256_mullo_epi32(_mm256_add_epi32(_mm256_mullo_epi32(qa, nB), qb), nL), ql);
+}
+
+__attribute__((target("avx2")))
+static int maskAndBinsAvx2(const uchar* l, const uchar* a, const uchar* b, int n, int threshold,
+    const BinLayout& layout, uchar* mask, int* bin, int& done){
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i one = _mm256_set1_epi8(1);
+  const __m256i below = _mm256_set1_epi8((char) max(threshold - 1, 0));
+  const __m256i mulL = _mm256_set1_epi32(layout.mulL);
+  const __m256i mulA = _mm256_set1_epi32(layout.mulA);
+  const __m256i mulB = _mm256_set1_epi32(layout.mulB);
+  const __m256i nB = _mm256_set1_epi32(layout.nB);
+  const __m256i nL = _mm256_set1_epi32(layout.nL);
+
+  int count = 0;
+  int j = 0;
+  for(; j + 32 <= n; j += 32){
+    if(mask != 0){
+      __m256i vl = _mm256_loadu_si256((const __m256i*) (l + j));
+      // l < threshold if l saturated minus (threshold - 1) is zero
+      __m256i psp = _mm256_cmpeq_epi8(_mm256_subs_epu8(vl, below), zero);
+      if(threshold == 0){
+        psp = zero;
+      }
+      _mm256_storeu_si256((__m256i*) (mask + j), _mm256_and_si256(psp, _mm256_add_epi8(vl, one)));
+      count += __builtin_popcount((unsigned int) _mm256_movemask_epi8(psp));
+    }
+    if(bin != 0){
+      for(int k = 0; k < 32; k += 8){
+        _mm256_storeu_si256((__m256i*) (bin + j + k), quantize8(l + j + k, a + j + k, b + j + k, mulL, mulA, mulB, nB, nL));
+      }
+    }
+  }
+
+  done = j;
+  return count;
+}
+
+#endif
+
+#if defined(__SSE2__)
+
+// 8 pixels widened to 16 bits: v / step is mulhi(v, mul), except for step 1 whose multiplier does not fit
+static inline __m128i divide8(const __m128i& v, const __m128i& mul, bool identity){
+  return identity ? v : _mm_mulhi_epu16(v, mul);
+}
+
+static int maskAndBinsSse2(const uchar* l, const uchar* a, const uchar* b, int n, int threshold,
+    const BinLayout& layout, uchar* mask, int* bin, int& done){
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi8(1);
+  const __m128i below = _mm_set1_epi8((char) max(threshold - 1, 0));
+  const __m128i mulL = _mm_set1_epi16((short) layout.mulL);
+  const __m128i mulA = _mm_set1_epi16((short) layout.mulA);
+  const __m128i mulB = _mm_set1_epi16((short) layout.mulB);
+  const __m128i nB = _mm_set1_epi16((short) layout.nB);
+  const __m128i nL = _mm_set1_epi16((short) layout.nL);
+  const bool identityL = layout.lStep == 1;
+  const bool identityA = layout.aStep == 1;
+  const bool identityB = layout.bStep == 1;
+
+  int count = 0;
+  int j = 0;
+  for(; j + 16 <= n; j += 16){
+    __m128i vl = _mm_loadu_si128((const __m128i*) (l + j));
+    if(mask != 0){
+      // l < threshold if l saturated minus (threshold - 1) is zero
+      __m128i psp = _mm_cmpeq_epi8(_mm_subs_epu8(vl, below), zero);
+      if(threshold == 0){
+        psp = zero;
+      }
+      _mm_storeu_si128((__m128i*) (mask + j), _mm_and_si128(psp, _mm_add_epi8(vl, one)));
+      count += __builtin_popcount((unsigned int) _mm_movemask_epi8(psp));
+    }
+    if(bin != 0){
+      __m128i va = _mm_loadu_si128((const __m128i*) (a + j));
+      __m128i vb = _mm_loadu_si128((const __m128i*) (b + j));
+      for(int half = 0; half < 2; half++){
+        __m128i l16 = half == 0 ? _mm_unpacklo_epi8(vl, zero) : _mm_unpackhi_epi8(vl, zero);
+        __m128i a16 = half == 0 ? _mm_unpacklo_epi8(va, zero) : _mm_unpackhi_epi8(va, zero);
+        __m128i b16 = half == 0 ? _mm_unpacklo_epi8(vb, zero) : _mm_unpackhi_epi8(vb, zero);
+        __m128i ql = divide8(l16, mulL, identityL);
+        __m128i qa = divide8(a16, mulA, identityA);
+        __m128i qb = divide8(b16, mulB, identityB);
+
+        // chroma = a * nB + b fits in 16 bits, chroma * nL is rebuilt in 32 bits from its low and high halves
+        __m128i chroma = _mm_add_epi16(_mm_mullo_epi16(qa, nB), qb);
+        __m128i lo = _mm_mullo_epi16(chroma, nL);
+        __m128i hi = _mm_mulhi_epu16(chroma, nL);
+        __m128i bin0 = _mm_add_epi32(_mm_unpacklo_epi16(lo, hi), _mm_unpacklo_epi16(ql, zero));
+        __m128i bin1 = _mm_add_epi32(_mm_unpackhi_epi16(lo, hi), _mm_unpackhi_epi16(ql, zero));
+        _mm_storeu_si128((__m128i*) (bin + j + 8 * half), bin0);
+        _mm_storeu_si128((__m128i*) (bin + j + 8 * half + 4), bin1);
+      }
+    }
+  }
+
+  done = j;
+  return count;
+}
+
+#endif
+
+static int maskAndBinsNone(const uchar* l, const uchar* a, const uchar* b, int n, int threshold,
+    const BinLayout& layout, uchar* mask, int* bin, int& done){
+  done = 0;
+  return 0;
+}
+
+/**
+* Returns the widest kernel supported by the processor running the code
+*/
+static MaskAndBinsKernel selectKernel(){
+#if defined(KERNELS_AVX2)
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2")){
+    return maskAndBinsAvx2;
+  }
+#endif
+#if defined(__SSE2__)
+  return maskAndBinsSse2;
+#else
+  return maskAndBinsNone;
+#endif
+}
+
+/**
+* Vectorized part of the kernels: it processes the first pixels of the row and sets done to their number,
+* the scalar version processes the rest. The kernel is chosen once per process
+*/
+static int maskAndBinsSimd(const uchar* l, const uchar* a, const uchar* b, int n, int threshold,
+    const BinLayout& layout, uchar* mask, int* bin, int& done){
+  static const MaskAndBinsKernel kernel = selectKernel();
+  return kernel(l, a, b, n, threshold, layout, mask, bin, done);
+}
+
+/**
+* This function computes the PSP mask of a row. A pixel is a PSP if its lightness is below threshold:
+* its mask value is its lightness plus 1, otherwise it is 0.
+*
+* @param l lightness of the row
+* @param n number of pixels
+* @param threshold integer threshold. See lightnessThreshold()
+* @param mask output mask of the row
+* @return number of PSP in the row
+*/
+int maskRow(const uchar* l, int n, int threshold, uchar* mask){
+  int done = 0;
+  int count = maskAndBinsSimd(l, 0, 0, n, threshold, unusedLayout, mask, 0, done);
+  return count + maskAndBinsScalar(l + done, 0, 0, n - done, threshold, unusedLayout, mask + done, 0);
+}
+
+/**
+* This function computes the bin of each pixel of a row. See BinIndex.h for the layout of bins.
+*
+* @param l lightness of the row
+* @param a a* component of the row
+* @param b b* component of the row
+* @param n number of pixels
+* @param layout bin layout. See makeBinLayout()
+* @param bin output bins of the row
+*/
+void quantizeRow(const uchar* l, const uchar* a, const uchar* b, int n, const BinLayout& layout, int* bin){
+  int done = 0;
+  maskAndBinsSimd(l, a, b, n, 0, layout, 0, bin, done);
+  maskAndBinsScalar(l + done, a + done, b + done, n - done, 0, layout, 0, bin + done);
+}
+
+/**
+* This function computes PSP mask and bins of a row in a single pass. See maskRow() and quantizeRow().
+*
+* @return number of PSP in the row
+*/
+int maskAndBinsRow(const uchar* l, const uchar* a, const uchar* b, int n, int threshold, const BinLayout& layout,
+    uchar* mask, int* bin){
+  int done = 0;
+  int count = maskAndBinsSimd(l, a, b, n, threshold, layout, mask, bin, done);
+  return count + maskAndBinsScalar(l + done, a + done, b + done, n - done, threshold, layout, mask + done, bin + done);
+}
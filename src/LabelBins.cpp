@@ -0,0 +1,160 @@
+/**
+ * @file LabelBins.cpp
+ * The goal of the code in this file is to provide the implementation of labelBins().
+ * It replaces the per-bin calls to connectedComponents(): instead of building a full
+ * image mask for every bin and labeling it, the pixels bucketed by bin are scanned
+ * once and 8-connected runs with equal bin are merged with a union-find.
+ *
+ * @author Martini Davide
+ * @version 1.1
+ * @since 1.1
+ *
+ */
+
+#include "LabelBins.h"
+
+/**
+* Returns the root of run r. Roots always have the lowest index in their set, so that
+* components are numbered in raster order of their first run
+*/
+static int findRoot(vector<int>& parent, int r){
+  while(parent[r] != r){
+    parent[r] = parent[parent[r]]; // path halving
+    r = parent[r];
+  }
+  return r;
+}
+
+static void unite(vector<int>& parent, int a, int b){
+  a = findRoot(parent, a);
+  b = findRoot(parent, b);
+  if(a < b){
+    parent[b] = a;
+  }
+  else if(b < a){
+    parent[a] = b;
+  }
+}
+
+/**
+* This function labels the connected components of the mask in a single pass over the bin index.
+* Two mask pixels are connected if they are 8-neighbours and have the same bin, i.e. the result
+* is the same as calling connectedComponents() on the mask of every bin separately.
+* The pixels of each bucket are in raster order, so they are split into runs on the fly and
+* every run is merged with the runs of the previous row of the same bucket that touch it.
+* Runs, areas and bounding boxes of the components are collected during the same scan, and
+* components come out grouped by bin.
+*
+* @param index pixels of the mask bucketed by bin. See BinIndex.cpp
+* @param cols number of columns of the image the index was built on
+* @param cs output runs, components and bin groups
+*/
+void labelBins(const BinIndex& index, int cols, ComponentSet& cs){
+  vector<Run>& rawRuns = cs.rawRuns; // runs in the order they are found
+  vector<int>& rawBin = cs.rawBin; // bin of each raw run
+  vector<int>& parent = cs.parent; // union-find forest over raw runs
+  rawRuns.clear();
+  rawBin.clear();
+  parent.clear();
+
+  for(int k = 0; k < (int) index.bins.size(); k++){
+    int prevBegin = 0; // raw runs of the previous row of this bin are in [prevBegin, prevEnd)
+    int prevEnd = 0;
+    int curBegin = rawRuns.size();
+    int curRow = -2;
+    int p = 0; // first run of the previous row that can still touch the current one
+
+    int w = index.offsets[k];
+    const int end = index.offsets[k + 1];
+    while(w < end){
+      const int row = index.pixels[w] / cols;
+      const int rowStart = row * cols;
+      if(row != curRow){
+        if(row == curRow + 1){
+          prevBegin = curBegin;
+          prevEnd = rawRuns.size();
+        }
+        else{
+          prevBegin = 0;
+          prevEnd = 0;
+        }
+        curBegin = rawRuns.size();
+        curRow = row;
+        p = prevBegin;
+      }
+
+      // extend the run while pixels are consecutive on the same row
+      const int start = index.pixels[w] - rowStart;
+      int last = index.pixels[w];
+      w++;
+      while(w < end && index.pixels[w] == last + 1 && index.pixels[w] < rowStart + cols){
+        last++;
+        w++;
+      }
+      const int stop = last - rowStart + 1;
+
+      int r = rawRuns.size();
+      Run run = {row, start, stop};
+      rawRuns.push_back(run);
+      rawBin.push_back(index.bins[k]);
+      parent.push_back(r);
+
+      // runs of the previous row touch [start, stop) if they overlap [start - 1, stop]
+      while(p < prevEnd && rawRuns[p].colEnd < start){
+        p++;
+      }
+      for(int q = p; q < prevEnd && rawRuns[q].colBegin <= stop; q++){
+        unite(parent, q, r);
+      }
+    }
+  }
+
+  // assign component ids in order of their first run and collect areas and bounding boxes.
+  // Bins are visited in increasing order, so components of the same bin are consecutive
+  vector<int>& runComp = cs.runComp;
+  runComp.resize(rawRuns.size());
+  cs.comps.clear();
+  cs.groups.clear();
+  for(int r = 0; r < (int) rawRuns.size(); r++){
+    int root = findRoot(parent, r);
+    const Run& run = rawRuns[r];
+    if(root == r){
+      BinComponent comp = {rawBin[r], 0, Rect(run.colBegin, run.row, 0, 0), 0, 0};
+      runComp[r] = cs.comps.size();
+      cs.comps.push_back(comp);
+
+      if(cs.groups.empty() || cs.groups.back().bin != comp.bin){
+        BinGroup group = {comp.bin, 0, runComp[r], 0};
+        cs.groups.push_back(group);
+      }
+      cs.groups.back().numComps++;
+    }
+    else{
+      runComp[r] = runComp[root];
+    }
+
+    BinComponent& comp = cs.comps[runComp[r]];
+    int x0 = min(comp.bbox.x, run.colBegin);
+    int x1 = max(comp.bbox.x + comp.bbox.width, run.colEnd);
+    comp.bbox = Rect(x0, comp.bbox.y, x1 - x0, run.row + 1 - comp.bbox.y);
+    comp.area += run.colEnd - run.colBegin;
+    comp.numRuns++;
+    cs.groups.back().area += run.colEnd - run.colBegin;
+  }
+
+  // store the runs of each component contiguously
+  int firstRun = 0;
+  for(int c = 0; c < (int) cs.comps.size(); c++){
+    cs.comps[c].firstRun = firstRun;
+    firstRun += cs.comps[c].numRuns;
+  }
+
+  cs.runs.resize(rawRuns.size());
+  vector<int>& fill = cs.fill;
+  fill.assign(cs.comps.size(), 0);
+  for(int r = 0; r < (int) rawRuns.size(); r++){
+    int c = runComp[r];
+    cs.runs[cs.comps[c].firstRun + fill[c]] = rawRuns[r];
+    fill[c]++;
+  }
+}
@@ -2,9 +2,16 @@
  * @file Main.cpp
  *  The goal of the code in this file is to provide an effective strategy to segment
  *  a picture into shadow and non-shadow areas. In particular, it relies on OpenCV library
- *  to convert the input RGB image into the CIE L*a*b* (or Lab) color space and to retrieve
- *  connected components.
+ *  to convert the input RGB image into the CIE L*a*b* (or Lab) color space. Connected
+ *  components of pixels with equal color bin are retrieved by labelBins(). The pipeline is run by
+ *  a ShadowDetector, which is also available as a library. See ShadowDetector.cpp.
  *  The results are printed in an external file in order to easily analyze the output.
+ *  With --sweep, many (lStep, aStep, bStep) triples are evaluated on the same image. See Sweep.cpp.
+ *  With --batch, a whole folder or list of images is processed in a single run. See Batch.cpp.
+ *  With --compare-filters, the filter modes are compared on a set of images. See FilterCompare.cpp.
+ *  With --tiled, images larger than the memory are processed by bands. See Tiled.cpp.
+ *  With --server, requests are served by a long running process. See Server.cpp.
+ *  With --video, the frames of a video are processed incrementally. See Video.cpp.
  *
  * @author Martini Davide
  * @version 1.0
@@ -12,20 +19,228 @@
  *
  */
 
-#include "FindShadow.h"
+#include "ShadowDetector.h"
+#include "Sweep.h"
+#include "Batch.h"
+#include "FilterCompare.h"
+#include "Tiled.h"
+#include "MaskWriter.h"
+#include "Server.h"
+#include "Video.h"
+
+/**
+* Prints the profile and writes the trace, if they were requested. Returns status
+*/
+static int finishProfile(int status, const string& tracePath){
+  if(profilingEnabled()){
+    printProfileSummary();
+  }
+  if(!tracePath.empty()){
+    if(writeTrace(tracePath)){
+      cout << "Trace written in " << tracePath << endl;
+    }
+    else{
+      cout << "Can not write " << tracePath << endl;
+    }
+  }
+  return status;
+}
+
+static void printUsage(){
+  cout << endl;
+  cout << "Run this executable by invoking it like this: " << endl;
+  cout << "   ./ShadowDet ../data/flickr-4159721472_c55deb37d6_b.jpg 20 50 50" << endl;
+  cout << endl;
+  cout << "The first argument is the input image path." << endl;
+  cout << "The second argument is the lStep parameter. It must be positive." << endl;
+  cout << "The third argument is the aStep parameter. It must be positive." << endl;
+  cout << "The fourth argument is the bStep parameter. It must be positive." << endl;
+  cout << endl;
+  cout << "To evaluate many steps on the same image, invoke it like this: " << endl;
+  cout << "   ./ShadowDet --sweep \"10:60:10,10,10;20,50,50\" ../data/flickr-4159721472_c55deb37d6_b.jpg" << endl;
+  cout << "Triples are separated by ';'. Each step is a value or an inclusive range from:to[:by], up to 256." << endl;
+  cout << endl;
+  cout << "To process a folder, or a text file with one image path per line, invoke it like this: " << endl;
+  cout << "   ./ShadowDet --batch ../data 20 50 50 [output folder]" << endl;
+  cout << "Masks are written in ../results/batch unless an output folder is given." << endl;
+  cout << endl;
+  cout << "In every mode, --filter bilateral|joint|half selects the edge preserving filter (default bilateral)." << endl;
+  cout << "In every mode, --profile prints the time of each stage, --trace file.json also writes a Chrome trace" << endl;
+  cout << "and --verbose prints one line per analyzed bin." << endl;
+  cout << "Masks are written as --format png|jpg|pbm|rle (default png). --mmap writes PBM files through a memory" << endl;
+  cout << "mapping and --no-intermediate skips the PSP mask (mask_step_one)." << endl;
+  cout << "To compare speed and quality of the filters on a folder, a list or a single image, invoke it like this: " << endl;
+  cout << "   ./ShadowDet --compare-filters ../data 20 50 50" << endl;
+  cout << endl;
+  cout << "To process an image larger than the memory, invoke it like this: " << endl;
+  cout << "   ./ShadowDet --tiled ../data/huge.ppm 20 50 50 ../results/huge_mask.pgm [budget in MB]" << endl;
+  cout << "Binary PPM images are read by bands. The mask is written as a binary PGM. The default budget is 256 MB." << endl;
+  cout << endl;
+  cout << "To serve requests from a long running process, invoke it like this: " << endl;
+  cout << "   ./ShadowDet --server /tmp/shadowdet.sock [workers]" << endl;
+  cout << "Use - instead of the socket path to read requests from the standard input. Workers are 2 by default." << endl;
+  cout << "The protocol is described in Server.cpp." << endl;
+  cout << endl;
+  cout << "To process a video or a camera, invoke it like this: " << endl;
+  cout << "   ./ShadowDet --video ../data/street.mp4 20 50 50 [output video]" << endl;
+  cout << "Use the index of a camera, for example 0, instead of the path. Masks are written as a lossless FFV1" << endl;
+  cout << "video, so the output should end in .mkv or .avi." << endl;
+  cout << endl;
+}
 
 int main(int argc, char** argv){
 
+  // options valid in every mode are removed from the arguments
+  FilterMode filter = FILTER_BILATERAL;
+  string tracePath;
+  MaskOutput output;
+  vector<char*> args;
+  for(int a = 0; a < argc; a++){
+    if(string(argv[a]) == "--filter" && a + 1 < argc){
+      if(!parseFilterMode(argv[a + 1], filter)){
+        cout << endl;
+        cout << "Wrong argument! Unknown filter mode " << argv[a + 1] << "." << endl;
+        printUsage();
+        return 1;
+      }
+      a++;
+    }
+    else if(string(argv[a]) == "--trace" && a + 1 < argc){
+      tracePath = argv[a + 1];
+      setProfiling(true);
+      a++;
+    }
+    else if(string(argv[a]) == "--format" && a + 1 < argc){
+      if(!parseMaskFormat(argv[a + 1], output.format)){
+        cout << endl;
+        cout << "Wrong argument! Unknown mask format " << argv[a + 1] << "." << endl;
+        printUsage();
+        return 1;
+      }
+      a++;
+    }
+    else if(string(argv[a]) == "--mmap"){
+      output.mapped = true;
+    }
+    else if(string(argv[a]) == "--no-intermediate"){
+      output.intermediate = false;
+    }
+    else if(string(argv[a]) == "--profile"){
+      setProfiling(true);
+    }
+    else if(string(argv[a]) == "--verbose"){
+      setVerbose(true);
+    }
+    else{
+      args.push_back(argv[a]);
+    }
+  }
+  argc = args.size();
+  argv = args.data();
+
+  if (argc == 4 && string(argv[1]) == "--sweep"){
+    vector<StepTriple> triples;
+    if(!parseSweep(argv[2], triples)){
+      cout << endl;
+      cout << "Wrong argument! Can not parse the list of steps. Steps must be in [1, 256] and at most 65536 triples" << endl;
+      cout << "can be evaluated at once." << endl;
+      printUsage();
+      return 1;
+    }
+
+    TaskScheduler scheduler;
+    cout << "Max threads concurrent: " << scheduler.size() << ", triples: " << triples.size() << endl;
+    return finishProfile(runSweep(argv[3], triples, filter, output, scheduler), tracePath);
+  }
+
+  if ((argc == 6 || argc == 7) && string(argv[1]) == "--batch"){
+    const int lStep = atoi(argv[3]);
+    const int aStep = atoi(argv[4]);
+    const int bStep = atoi(argv[5]);
+    const string outDir = (argc == 7) ? argv[6] : "../results/batch";
+
+    vector<string> paths;
+    if(aStep <= 0 || bStep <=0 || lStep <= 0 || !listImages(argv[2], paths)){
+      cout << endl;
+      cout << "Wrong argument! Steps must be positive and the input must be a folder or a list of images." << endl;
+      printUsage();
+      return 1;
+    }
+
+    TaskScheduler scheduler;
+    cout << "Max threads concurrent: " << scheduler.size() << ", images: " << paths.size() << endl;
+    return finishProfile(runBatch(paths, lStep, aStep, bStep, filter, outDir, output, scheduler), tracePath);
+  }
+
+  if (argc == 6 && string(argv[1]) == "--compare-filters"){
+    const int lStep = atoi(argv[3]);
+    const int aStep = atoi(argv[4]);
+    const int bStep = atoi(argv[5]);
+
+    vector<string> paths;
+    if(aStep <= 0 || bStep <=0 || lStep <= 0 || !listImages(argv[2], paths)){
+      cout << endl;
+      cout << "Wrong argument! Steps must be positive and the input must be an image, a folder or a list of images." << endl;
+      printUsage();
+      return 1;
+    }
+
+    TaskScheduler scheduler;
+    return finishProfile(compareFilters(paths, lStep, aStep, bStep, scheduler), tracePath);
+  }
+
+  if ((argc == 7 || argc == 8) && string(argv[1]) == "--tiled"){
+    const int lStep = atoi(argv[3]);
+    const int aStep = atoi(argv[4]);
+    const int bStep = atoi(argv[5]);
+    const int budgetMb = (argc == 8) ? atoi(argv[7]) : 256;
+
+    if(aStep <= 0 || bStep <=0 || lStep <= 0 || budgetMb <= 0){
+      cout << endl;
+      cout << "Wrong argument! Steps and memory budget must be positive." << endl;
+      printUsage();
+      return 1;
+    }
+
+    TaskScheduler scheduler;
+    cout << "Max threads concurrent: " << scheduler.size() << endl;
+    return finishProfile(runTiled(argv[2], lStep, aStep, bStep, filter, argv[6], budgetMb, scheduler), tracePath);
+  }
+
+  if ((argc == 3 || argc == 4) && string(argv[1]) == "--server"){
+    const int workers = (argc == 4) ? atoi(argv[3]) : 2;
+    if(workers <= 0){
+      cout << endl;
+      cout << "Wrong argument! The number of workers must be positive." << endl;
+      printUsage();
+      return 1;
+    }
+
+    // the responses of the standard input mode are written on the standard output, which must carry nothing else
+    cout.rdbuf(cerr.rdbuf());
+    return finishProfile(runServer(argv[2], workers, filter, output), tracePath);
+  }
+
+  if ((argc == 6 || argc == 7) && string(argv[1]) == "--video"){
+    const int lStep = atoi(argv[3]);
+    const int aStep = atoi(argv[4]);
+    const int bStep = atoi(argv[5]);
+    const string outPath = (argc == 7) ? argv[6] : "";
+
+    if(aStep <= 0 || bStep <=0 || lStep <= 0){
+      cout << endl;
+      cout << "Wrong argument! lStep, aStep and bStep must be positive." << endl;
+      printUsage();
+      return 1;
+    }
+
+    TaskScheduler scheduler;
+    cout << "Max threads concurrent: " << scheduler.size() << endl;
+    return finishProfile(runVideo(argv[2], lStep, aStep, bStep, filter, outPath, scheduler), tracePath);
+  }
+
   if (argc != 5){
-    cout << endl;
-    cout << "Run this executable by invoking it like this: " << endl;
-    cout << "   ./ShadowDet ../data/flickr-4159721472_c55deb37d6_b.jpg 20 50 50" << endl;
-    cout << endl;
-    cout << "The first argument is the input image path." << endl;
-    cout << "The second argument is the lStep parameter. It must be positive." << endl;
-    cout << "The third argument is the aStep parameter. It must be positive." << endl;
-    cout << "The fourth argument is the bStep parameter. It must be positive." << endl;
-    cout << endl;
+    printUsage();
     return 1;
   }
 
@@ -43,11 +258,22 @@ int main(int argc, char** argv){
     return 1;
   }
 
+  // the detector keeps its threads and buffers. See ShadowDetector.cpp
+  ShadowConfig config;
+  config.lStep = lStep;
+  config.aStep = aStep;
+  config.bStep = bStep;
+  config.filter = filter;
+  ShadowDetector detector(config);
+
   chrono::time_point<chrono::system_clock> start, end;
   start = chrono::system_clock::now();
 
   Mat imgRGB;
-  imgRGB = imread(srcPath);
+  {
+    PROFILE_SCOPE("load");
+    imgRGB = imread(srcPath);
+  }
 
   if(imgRGB.empty()){
     cout << "Wrong argument! Can not open input image. Check for errors in the provided path" << endl;
@@ -57,161 +283,28 @@ int main(int argc, char** argv){
     return 1;
   }
 
-  // in this process we use CIE LAB color space
-  Mat imgLAB;
-  cvtColor(imgRGB, imgLAB, COLOR_RGB2Lab);
-
-  Mat channelLAB[3];
-  split(imgLAB, channelLAB);
-  Mat imgL = channelLAB[0];
-  Mat imgA = channelLAB[1];
-  Mat imgB = channelLAB[2];
-
-  //bilateral filter to reduce noise but preserve edges
-  Mat lFiltered;
-  bilateralFilter(imgL, lFiltered, 5, 80, 80);
-  imgL = lFiltered;
-  lFiltered.release();
-
-  Mat aFiltered;
-  bilateralFilter(imgA, aFiltered, 5, 80, 80);
-  imgA = aFiltered;
-  aFiltered.release();
-
-  Mat bFiltered;
-  bilateralFilter(imgB, bFiltered, 5, 80, 80);
-  imgB = bFiltered;
-  bFiltered.release();
-
-  // compute the mean and the standard deviation of the luminance component
-  // these values are considered as the "background light" so they allow to
-  // distinguish "probably shadow pixels" (PSP) from surely "not shadow pixels" (NSP)
-  Mat imgLD, meanL, stdDevL;
-  bool useSTD = true;
-  imgL.convertTo(imgLD, CV_64FC1);
-  meanStdDev(imgLD, meanL, stdDevL);
-  if(stdDevL.at<double> (0, 0) <  (double) 255 / 6){
-    useSTD = false;
-  }
+  // convert, filter, find the "probably shadow pixels" (PSP) and then the shadow pixels (SP) among them
+  cout << "Max threads concurrent: " << detector.scheduler().size() << endl;
+  Mat maskFinal;
+  DetectStats stats;
+  detector.detect(imgRGB, maskFinal, &stats);
+  const FrontEnd& fe = detector.frontEnd();
 
-  cout << "Mean lightness value: " << meanL.at<double> (0, 0) << ", standard deviation: " << stdDevL.at<double> (0, 0)
-       << " useSTD: " << useSTD << endl;
-
-  // create the mask
-  Mat maskAvgL = Mat_<uchar>::zeros(imgL.size());
-
-  // depending on the standard deviation on imgL, each pixel with lightness component less than meanL - stdDevL/3
-  // or simply meanL is a PSP, otherwise it is a NSP.
-  // in the resulting masks, each PSP value is set to the one assumed in the luminance image plus 1
-  // while each NSP remains set to 0
-  int maskPixels = 0;
-  for(int i = 0; i < maskAvgL.rows; i++){
-    for(int j = 0; j < maskAvgL.cols; j++){
-      if(useSTD){
-        if(imgLD.at<double> (i, j) < (meanL.at<double> (0, 0) - (stdDevL.at<double> (0, 0) / 3))){
-          maskAvgL.at<uchar> (i, j) = 1 + imgL.at<uchar> (i, j);
-          maskPixels++;
-        }
-        else{
-          maskAvgL.at<uchar> (i, j) = 0;
-        }
-      }
-      else{
-        if(imgLD.at<double> (i, j) < meanL.at<double> (0, 0)){
-          maskAvgL.at<uchar> (i, j) = 1 + imgL.at<uchar> (i, j);
-          maskPixels++;
-        }
-        else{
-          maskAvgL.at<uchar> (i, j) = 0;
-        }
-      }
-    }
-  }
+  cout << "Mean lightness value: " << fe.meanL << ", standard deviation: " << fe.stdDevL
+       << " useSTD: " << fe.useSTD << endl;
 
   // write the files to see results
-  imwrite("../results/mask_step_one.jpg", maskAvgL);
-
-  // now further computation to detect the shadow pixels (SP) from the PSP
-  map<tuple<int, int, int> , vector<Point> > labMap;
-  map<tuple<int, int, int>, vector<Point> >::iterator labIt;
-
-  // fill  labMap:
-  // key = (l*, a*, b*) pixel component. It represents a color bin
-  // value = points of the mask in the bin
-  for (int i = 0; i < maskAvgL.rows; i++){
-    for (int j = 0; j < maskAvgL.cols; j++){
-      if (maskAvgL.at<uchar> (i, j) != 0){
-        Point p(i, j);
-        int theL = ceil(imgL.at<uchar> (i, j) / lStep);
-        int theA = ceil(imgA.at<uchar> (i, j) / aStep);
-        int theB = ceil(imgB.at<uchar> (i, j) / bStep);
-        tuple<int, int, int> key = make_tuple(theL, theA, theB);
-
-        labIt = labMap.find(key);
-        if(labIt == labMap.end()){
-          vector<Point> v;
-          v.push_back(p);
-          labMap.insert(pair<tuple<int, int, int>, vector<Point> >(key, v));
-        }
-        else{
-          labMap[key].push_back(p);
-        }
-      }
-    }
-  }
-
-  int labMapPixels = 0;
-  for (labIt = labMap.begin(); labIt != labMap.end(); labIt++){
-    vector<Point> labPixels = labIt->second;
-    labMapPixels = labMapPixels + labPixels.size();
-  }
-
-  if(maskPixels == labMapPixels){
-    cout << "labMap succesfully created. Entries in labMap: " << labMap.size() << endl;
-  }
-
-  // use thread pool to analyze each (key, value) pair in labMap
-  const int poolSize = thread::hardware_concurrency();
-  cout << "Max threads concurrent: " << poolSize << endl;
-  vector<thread> threads;
-  vector<Point> shadowPoints;
-  labIt = labMap.begin();
-
-  while(labIt != labMap.end()){
-    if(threads.size() < poolSize){
-      // lauch thread form the pool. See FindShadow.cpp for more information
-      threads.push_back(thread(findShadow, imgL, imgA, imgB, labIt->first, labIt->second, lStep, aStep, bStep, ref(shadowPoints)));
-      labIt++; // move to the next (key, value) pair in labMap
-    }
-    else{
-      // wait for threads to finish their computation
-      for(int t = 0; t < threads.size(); t++){
-        threads[t].join();
-      }
-      // free the pool
-      threads.erase(threads.begin(), threads.end());
-    }
+  if(output.intermediate){
+    writeMask("../results/mask_step_one" + maskExtension(output.format), fe.maskAvgL, output, false);
   }
 
-  // wait for active threads remaining
-  for(int t = 0; t < threads.size(); t++){
-    threads[t].join();
+  if(fe.maskPixels == stats.indexedPixels){
+    cout << "Bin index succesfully created. Entries in bin index: " << stats.bins << endl;
   }
-  // free the pool
-  threads.erase(threads.begin(), threads.end());
+  cout << "Components succesfully labeled: " << stats.components << endl;
 
   // write the final result
-  Mat maskFinal = Mat_<uchar>::zeros(maskAvgL.size());
-
-  for (int i = 0; i < shadowPoints.size(); i++){
-    Point p = shadowPoints[i];
-    maskFinal.at<uchar> (p.x, p.y) = 255;
-  }
-
-  stringstream sstm;
-  sstm << "../results/mask_step_two_lStep" << lStep << "_aStep" << aStep << "_bStep" << bStep << ".jpg";
-  string s = sstm.str();
-  imwrite(s, maskFinal);
+  writeMask("../results/" + maskName(lStep, aStep, bStep) + maskExtension(output.format), maskFinal, output);
 
   // provide information to the user
   end = chrono::system_clock::now();
@@ -220,5 +313,5 @@ int main(int argc, char** argv){
 
   cout << "Finished computation at " << ctime(&end_time) << " Elapsed time: " << elapsed_seconds << " ms" << endl;
 
-  return 0;
+  return finishProfile(0, tracePath);
 }
@@ -0,0 +1,194 @@
+/**
+ * @file MaskWriter.cpp
+ * The goal of the code in this file is to write masks in compact and lossless formats. JPEG is lossy on a binary
+ * mask and slow to encode, so the final mask is written by default as a PNG with the fastest compression level.
+ * The other formats do not need an image library to be read back:
+ * 1) PBM (P4): a short text header followed by the rows packed 8 pixels per byte, the first pixel in the most
+ *    significant bit. A set bit is a masked pixel. The file can be written through a memory mapping;
+ * 2) RLE: the connected regions of the mask as lists of runs. After the header
+ *    "SDRL" width height regions, each region is stored as its number of runs and its area followed by
+ *    (row, first column, length) for each run. All values are 32 bit unsigned integers in the byte order of the
+ *    machine that wrote the file.
+ * Non binary masks, like the PSP mask, keep their values only as PNG and JPEG; the other formats store which
+ * pixels are not 0.
+ *
+ * @author Martini Davide
+ * @version 1.1
+ * @since 1.1
+ *
+ */
+
+#include "MaskWriter.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <stdint.h>
+
+/**
+* Parses the name of a mask format: "png", "jpg", "pbm" or "rle"
+*/
+bool parseMaskFormat(const string& name, MaskFormat& format){
+  if(name == "png"){
+    format = MASK_PNG;
+  }
+  else if(name == "jpg"){
+    format = MASK_JPG;
+  }
+  else if(name == "pbm"){
+    format = MASK_PBM;
+  }
+  else if(name == "rle"){
+    format = MASK_RLE;
+  }
+  else{
+    return false;
+  }
+  return true;
+}
+
+string maskExtension(MaskFormat format){
+  switch(format){
+    case MASK_JPG: return ".jpg";
+    case MASK_PBM: return ".pbm";
+    case MASK_RLE: return ".rle";
+    default: return ".png";
+  }
+}
+
+/**
+* Packs a row of the mask, 8 pixels per byte with the first one in the most significant bit
+*/
+static void packRow(const uchar* mask, int cols, uchar* bits){
+  int j = 0;
+  for(; j + 8 <= cols; j += 8){
+    bits[j >> 3] = (uchar) ((mask[j] ? 0x80 : 0) | (mask[j + 1] ? 0x40 : 0) | (mask[j + 2] ? 0x20 : 0)
+        | (mask[j + 3] ? 0x10 : 0) | (mask[j + 4] ? 0x08 : 0) | (mask[j + 5] ? 0x04 : 0)
+        | (mask[j + 6] ? 0x02 : 0) | (mask[j + 7] ? 0x01 : 0));
+  }
+  if(j < cols){
+    uchar last = 0;
+    for(int k = 0; j + k < cols; k++){
+      last |= mask[j + k] ? 0x80 >> k : 0;
+    }
+    bits[j >> 3] = last;
+  }
+}
+
+static bool writePbm(const string& path, const Mat& mask, bool mapped){
+  stringstream header;
+  header << "P4\n" << mask.cols << " " << mask.rows << "\n";
+  const string head = header.str();
+  const size_t rowBytes = (mask.cols + 7) / 8;
+
+  if(!mapped){
+    ofstream out(path.c_str(), ios::binary);
+    out << head;
+    vector<uchar> bits(rowBytes);
+    for(int i = 0; i < mask.rows; i++){
+      packRow(mask.ptr<uchar>(i), mask.cols, bits.data());
+      out.write((const char*) bits.data(), rowBytes);
+    }
+    return (bool) out;
+  }
+
+  // the rows are packed straight into the page cache
+  const size_t size = head.size() + rowBytes * mask.rows;
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0){
+    return false;
+  }
+  if(ftruncate(fd, size) != 0){
+    close(fd);
+    return false;
+  }
+  void* map = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED){
+    return false;
+  }
+  uchar* data = (uchar*) map;
+  memcpy(data, head.data(), head.size());
+  for(int i = 0; i < mask.rows; i++){
+    packRow(mask.ptr<uchar>(i), mask.cols, data + head.size() + rowBytes * i);
+  }
+  return munmap(map, size) == 0;
+}
+
+/**
+* Writes the connected regions of the mask. They are labeled by labelBins() as the components of a single bin
+*/
+static bool writeRle(const string& path, const Mat& mask){
+  BinIndex index;
+  index.bins.push_back(0);
+  index.offsets.push_back(0);
+  for(int i = 0; i < mask.rows; i++){
+    const uchar* row = mask.ptr<uchar>(i);
+    for(int j = 0; j < mask.cols; j++){
+      if(row[j]){
+        index.pixels.push_back(i * mask.cols + j);
+      }
+    }
+  }
+  index.offsets.push_back(index.pixels.size());
+  if(index.pixels.empty()){
+    index.bins.clear();
+    index.offsets.pop_back();
+  }
+
+  ComponentSet cs;
+  labelBins(index, mask.cols, cs);
+
+  vector<uint32_t> words;
+  words.reserve(4 + 2 * cs.comps.size() + 3 * cs.runs.size());
+  words.push_back(0);
+  words.push_back(mask.cols);
+  words.push_back(mask.rows);
+  words.push_back(cs.comps.size());
+  memcpy(&words[0], "SDRL", 4);
+  for(int c = 0; c < cs.comps.size(); c++){
+    const BinComponent& comp = cs.comps[c];
+    words.push_back(comp.numRuns);
+    words.push_back(comp.area);
+    for(int r = comp.firstRun; r < comp.firstRun + comp.numRuns; r++){
+      words.push_back(cs.runs[r].row);
+      words.push_back(cs.runs[r].colBegin);
+      words.push_back(cs.runs[r].colEnd - cs.runs[r].colBegin);
+    }
+  }
+
+  ofstream out(path.c_str(), ios::binary);
+  out.write((const char*) words.data(), words.size() * sizeof(uint32_t));
+  return (bool) out;
+}
+
+/**
+* This function writes a mask in the format of output.
+*
+* @param path output file path. Its extension should be maskExtension(output.format)
+* @param mask CV_8UC1 mask
+* @param output format of the file
+* @param binary true if mask only holds 0 and 255. Binary masks are written as 1 bit PNG
+* @return false if the file can not be written
+*/
+bool writeMask(const string& path, const Mat& mask, const MaskOutput& output, bool binary){
+  PROFILE_SCOPE("encode");
+  switch(output.format){
+    case MASK_PBM:
+      return writePbm(path, mask, output.mapped);
+    case MASK_RLE:
+      return writeRle(path, mask);
+    case MASK_JPG:
+      return imwrite(path, mask);
+    default:{
+      vector<int> params;
+      params.push_back(IMWRITE_PNG_COMPRESSION);
+      params.push_back(1);
+      if(binary){
+        params.push_back(IMWRITE_PNG_BILEVEL);
+        params.push_back(1);
+      }
+      return imwrite(path, mask, params);
+    }
+  }
+}
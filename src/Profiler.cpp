@@ -0,0 +1,251 @@
+/**
+ * @file Profiler.cpp
+ * The goal of the code in this file is to measure the stages of the pipeline with a low overhead.
+ * Each thread appends its events and counters to its own buffer, which is registered once under a mutex
+ * the first time the thread records something, so measuring a stage never takes a lock. Buffers outlive
+ * their threads, and they are read by writeTrace() and printProfileSummary() once the work is done.
+ * Each stage is also summed per thread, so a buffer keeps at most maxTraceEvents events: past it the trace
+ * loses the later events, while the summary and the stage totals still count all of them. This bounds the
+ * memory of long runs such as --server and --video.
+ * The trace is written in the Chrome trace event format, which is opened by chrome://tracing and Perfetto.
+ *
+ * @author Martini Davide
+ * @version 1.1
+ * @since 1.1
+ *
+ */
+
+#include "Profiler.h"
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+atomic<bool> profilingOn(false);
+atomic<bool> verboseOn(false);
+
+// events kept by each thread for the trace
+static const int maxTraceEvents = 1 << 16;
+
+struct TraceEvent {
+  const char* name;
+  long long startUs;
+  long long durationUs;
+};
+
+/**
+* Calls and time of a stage on a thread
+*/
+struct StageStats {
+  const char* name;
+  long long calls;
+  long long totalUs;
+  long long maxUs;
+};
+
+/**
+* Events, stages and counters of a thread
+*/
+struct ThreadTrace {
+  int tid;
+  vector<TraceEvent> events;
+  long long droppedEvents;
+  vector<StageStats> stages; // in order of first appearance
+  long long counters[NUM_COUNTERS];
+};
+
+static mutex registryMutex;
+static vector<unique_ptr<ThreadTrace> > registry;
+static thread_local ThreadTrace* localTrace = 0;
+static const chrono::steady_clock::time_point traceStart = chrono::steady_clock::now();
+
+static const char* counterNames[NUM_COUNTERS] = {"images", "bins", "components", "shadow components",
+    "border pixels examined", "early exits"};
+
+static ThreadTrace& threadTrace(){
+  if(localTrace == 0){
+    lock_guard<mutex> lock(registryMutex);
+    registry.push_back(unique_ptr<ThreadTrace>(new ThreadTrace()));
+    localTrace = registry.back().get();
+    localTrace->tid = registry.size() - 1;
+    localTrace->droppedEvents = 0;
+    fill(localTrace->counters, localTrace->counters + NUM_COUNTERS, 0);
+  }
+  return *localTrace;
+}
+
+void setProfiling(bool enabled){
+  profilingOn = enabled;
+}
+
+void setVerbose(bool enabled){
+  verboseOn = enabled;
+}
+
+/**
+* Returns the microseconds elapsed since the start of the program
+*/
+long long profileNowUs(){
+  return chrono::duration_cast<chrono::microseconds> (chrono::steady_clock::now() - traceStart).count();
+}
+
+void recordEvent(const char* name, long long startUs, long long durationUs){
+  ThreadTrace& trace = threadTrace();
+  if(trace.events.size() < maxTraceEvents){
+    TraceEvent event = {name, startUs, durationUs};
+    trace.events.push_back(event);
+  }
+  else{
+    trace.droppedEvents++;
+  }
+
+  // a thread measures a handful of stages, so a linear search on their pointers is enough
+  int s = 0;
+  while(s < trace.stages.size() && trace.stages[s].name != name){
+    s++;
+  }
+  if(s == trace.stages.size()){
+    StageStats stats = {name, 0, 0, 0};
+    trace.stages.push_back(stats);
+  }
+  StageStats& stats = trace.stages[s];
+  stats.calls++;
+  stats.totalUs += durationUs;
+  stats.maxUs = max(stats.maxUs, durationUs);
+}
+
+void addCounter(ProfileCounter counter, long long value){
+  if(profilingEnabled()){
+    threadTrace().counters[counter] += value;
+  }
+}
+
+static void sumCounters(long long totals[NUM_COUNTERS]){
+  fill(totals, totals + NUM_COUNTERS, 0);
+  for(int t = 0; t < registry.size(); t++){
+    for(int c = 0; c < NUM_COUNTERS; c++){
+      totals[c] += registry[t]->counters[c];
+    }
+  }
+}
+
+/**
+* This function sums, for each stage, the durations recorded by all threads. It must be called when no thread
+* is recording.
+*
+* @param totalsUs output total microseconds of each stage
+*/
+void stageTotals(map<string, long long>& totalsUs){
+  lock_guard<mutex> lock(registryMutex);
+  totalsUs.clear();
+  for(int t = 0; t < registry.size(); t++){
+    for(int s = 0; s < registry[t]->stages.size(); s++){
+      totalsUs[registry[t]->stages[s].name] += registry[t]->stages[s].totalUs;
+    }
+  }
+}
+
+/**
+* This function drops the events and counters recorded so far. It must be called when no thread is recording
+*/
+void resetProfile(){
+  lock_guard<mutex> lock(registryMutex);
+  for(int t = 0; t < registry.size(); t++){
+    registry[t]->events.clear();
+    registry[t]->droppedEvents = 0;
+    registry[t]->stages.clear();
+    fill(registry[t]->counters, registry[t]->counters + NUM_COUNTERS, 0);
+  }
+}
+
+/**
+* This function writes the events of all threads as a Chrome trace. It must be called when no thread is recording.
+* Only the first maxTraceEvents events of each thread are written.
+*
+* @param path output JSON file
+* @return false if the file can not be written
+*/
+bool writeTrace(const string& path){
+  lock_guard<mutex> lock(registryMutex);
+  ofstream out(path.c_str());
+  out << "{\"traceEvents\":[" << endl;
+  bool first = true;
+  for(int t = 0; t < registry.size(); t++){
+    const ThreadTrace& trace = *registry[t];
+    out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << trace.tid
+        << ",\"args\":{\"name\":\"thread " << trace.tid << "\"}}";
+    first = false;
+    for(int e = 0; e < trace.events.size(); e++){
+      const TraceEvent& event = trace.events[e];
+      out << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << trace.tid
+          << ",\"ts\":" << event.startUs << ",\"dur\":" << event.durationUs << "}";
+    }
+  }
+
+  // counters are shown as a track with their final values
+  long long totals[NUM_COUNTERS];
+  sumCounters(totals);
+  out << ",\n{\"name\":\"counters\",\"ph\":\"C\",\"pid\":1,\"ts\":" << profileNowUs() << ",\"args\":{";
+  for(int c = 0; c < NUM_COUNTERS; c++){
+    out << (c == 0 ? "" : ",") << "\"" << counterNames[c] << "\":" << totals[c];
+  }
+  out << "}}" << endl << "]}" << endl;
+
+  long long dropped = 0;
+  for(int t = 0; t < registry.size(); t++){
+    dropped += registry[t]->droppedEvents;
+  }
+  if(dropped > 0){
+    cerr << "The trace misses " << dropped << " events past the first " << maxTraceEvents << " of a thread" << endl;
+  }
+  return (bool) out;
+}
+
+/**
+* This function prints, for each stage, the number of calls and the total, mean and maximum time summed over
+* all threads, followed by the counters. It must be called when no thread is recording.
+*/
+void printProfileSummary(){
+  lock_guard<mutex> lock(registryMutex);
+
+  // stages in order of first appearance
+  vector<string> stages;
+  map<string, StageStats> merged;
+  for(int t = 0; t < registry.size(); t++){
+    for(int s = 0; s < registry[t]->stages.size(); s++){
+      const StageStats& stats = registry[t]->stages[s];
+      map<string, StageStats>::iterator it = merged.find(stats.name);
+      if(it == merged.end()){
+        stages.push_back(stats.name);
+        merged[stats.name] = stats;
+      }
+      else{
+        it->second.calls += stats.calls;
+        it->second.totalUs += stats.totalUs;
+        it->second.maxUs = max(it->second.maxUs, stats.maxUs);
+      }
+    }
+  }
+
+  cout << endl << left << setw(16) << "stage" << right << setw(10) << "calls" << setw(14) << "total ms"
+       << setw(14) << "mean us" << setw(14) << "max us" << endl;
+  for(int s = 0; s < stages.size(); s++){
+    const StageStats& stats = merged[stages[s]];
+    cout << left << setw(16) << stages[s] << right << setw(10) << stats.calls << setw(14) << fixed
+         << setprecision(2) << stats.totalUs / 1000.0 << setw(14) << stats.totalUs / stats.calls << setw(14)
+         << stats.maxUs << endl;
+  }
+
+  long long totals[NUM_COUNTERS];
+  sumCounters(totals);
+  cout << endl;
+  for(int c = 0; c < NUM_COUNTERS; c++){
+    cout << left << setw(24) << counterNames[c] << right << setw(14) << totals[c] << endl;
+  }
+  cout.unsetf(ios::fixed);
+  cout << setprecision(6);
+}
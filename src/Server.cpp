@@ -0,0 +1,531 @@
+/**
+ * @file Server.cpp
+ * The goal of the code in this file is to serve many detection requests from a single long running process, so
+ * that process startup, OpenCV initialization and thread creation are paid once. Requests arrive on a Unix domain
+ * socket, or on the standard input when the address is "-", and each connection may send many of them.
+ * A reader thread per connection parses the requests and pushes them into a bounded queue: when the queue is full
+ * the reader waits, so a client that sends faster than the server works is slowed down instead of growing memory.
+ * Encoded images are limited to maxPayloadBytes, and the images in the queue to serverQueueBytes altogether.
+ * A fixed set of workers pops the requests. Each worker owns a ShadowDetector that keeps its buffers warm across
+ * requests, and all detectors share one TaskScheduler.
+ *
+ * Protocol: one request per line, one response line per request. Responses of the same connection may come back
+ * in a different order, so each request carries an id chosen by the client. Paths must not contain spaces.
+ *   DETECT <id> <lStep> <aStep> <bStep> PATH <image path> <mask path>
+ *   DETECT <id> <lStep> <aStep> <bStep> BYTES <n> <mask path>     followed by n bytes of an encoded image
+ *   STATS
+ *   SHUTDOWN
+ * A mask path "-" means that the mask is not written. A BYTES line whose payload size can not be read, or a line
+ * longer than maxLineLength, closes the connection, since the next requests could not be told apart. Responses are
+ *   OK <id> <shadow pixels> <latency ms> <queue ms>
+ *   ERR <id> <reason>
+ *   STATS <requests> <p50 ms> <p95 ms> <p99 ms> <max ms>
+ * Latency is measured from the end of the request line to the response, and includes the transfer of the payload
+ * and the time in the queue.
+ * When the requests come from the standard input, logs and profiles are printed on the standard error.
+ *
+ * @author Martini Davide
+ * @version 1.1
+ * @since 1.1
+ *
+ */
+
+#include "Server.h"
+
+#include <memory>
+#include <set>
+#include <atomic>
+#include <csignal>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+const int serverQueueCapacity = 64;
+const size_t maxLineLength = 4096;
+const long long maxPayloadBytes = 64LL << 20;
+const long long serverQueueBytes = 256LL << 20; // encoded images waiting in the queue
+const int serverBacklog = 16;
+const int latencySamples = 1 << 16; // latencies kept for the percentiles
+
+/**
+* Client of the server. Its descriptors are closed when the last request that refers to it is done
+*/
+struct Connection {
+  int inFd;
+  int outFd;
+  bool owned; // false for the standard input and output
+  mutex writeMutex;
+
+  Connection(int in, int out, bool own) : inFd(in), outFd(out), owned(own){}
+  ~Connection(){
+    if(owned){
+      close(inFd);
+    }
+  }
+
+  /**
+  * Writes a whole line. Lines of concurrent workers are not interleaved
+  */
+  void reply(const string& line){
+    lock_guard<mutex> lock(writeMutex);
+    const char* data = line.data();
+    size_t left = line.size();
+    while(left > 0){
+      ssize_t n = write(outFd, data, left);
+      if(n <= 0){
+        return; // the client went away
+      }
+      data += n;
+      left -= n;
+    }
+  }
+};
+
+/**
+* Buffered reads of lines and byte blocks from a descriptor
+*/
+class LineReader {
+public:
+  explicit LineReader(int fd) : fd(fd), buffer(1 << 16), begin(0), end(0){}
+
+  /**
+  * Reads a line without its newline. A line longer than maxLength is returned as soon as maxLength + 1 of its
+  * characters are read, and the rest of it is left in the stream
+  */
+  bool readLine(string& line, size_t maxLength){
+    line.clear();
+    while(true){
+      if(begin == end && !fill()){
+        return !line.empty();
+      }
+      size_t available = min(end - begin, maxLength + 1 - line.size());
+      char* newline = (char*) memchr(&buffer[begin], '\n', available);
+      size_t stop = newline ? newline - &buffer[0] : begin + available;
+      line.append(&buffer[begin], stop - begin);
+      begin = newline ? stop + 1 : stop;
+      if(newline || line.size() > maxLength){
+        return true;
+      }
+    }
+  }
+
+  bool readBytes(size_t n, uchar* out){
+    while(n > 0){
+      if(begin == end && !fill()){
+        return false;
+      }
+      size_t chunk = min(n, end - begin);
+      memcpy(out, &buffer[begin], chunk);
+      begin += chunk;
+      out += chunk;
+      n -= chunk;
+    }
+    return true;
+  }
+
+private:
+  bool fill(){
+    ssize_t n;
+    do{
+      n = read(fd, &buffer[0], buffer.size());
+    } while(n < 0 && errno == EINTR);
+    begin = 0;
+    end = n > 0 ? n : 0;
+    return n > 0;
+  }
+
+  int fd;
+  vector<char> buffer;
+  size_t begin;
+  size_t end;
+};
+
+/**
+* Request waiting for a worker
+*/
+struct ServerJob {
+  shared_ptr<Connection> connection;
+  string id;
+  ShadowConfig config;
+  string inputPath; // empty if the image is sent as bytes
+  Mat encoded; // encoded image bytes
+  string maskPath;
+  chrono::time_point<chrono::steady_clock> received; // end of the request line
+  chrono::time_point<chrono::steady_clock> queued;
+};
+
+/**
+* Latencies of the last latencySamples requests
+*/
+class LatencyLog {
+public:
+  LatencyLog() : count(0){}
+
+  void add(double ms){
+    lock_guard<mutex> lock(m);
+    if(samples.size() < latencySamples){
+      samples.push_back(ms);
+    }
+    else{
+      samples[count % latencySamples] = ms;
+    }
+    count++;
+  }
+
+  string summary(){
+    vector<double> sorted;
+    long long total;
+    {
+      lock_guard<mutex> lock(m);
+      sorted = samples;
+      total = count;
+    }
+    stringstream sstm;
+    sstm << "STATS " << total;
+    if(sorted.empty()){
+      sstm << " 0 0 0 0";
+      return sstm.str();
+    }
+    sort(sorted.begin(), sorted.end());
+    const double fractions[] = {0.5, 0.95, 0.99};
+    for(int f = 0; f < 3; f++){
+      sstm << " " << sorted[max((int) ceil(fractions[f] * sorted.size()) - 1, 0)];
+    }
+    sstm << " " << sorted.back();
+    return sstm.str();
+  }
+
+private:
+  mutex m;
+  vector<double> samples;
+  long long count;
+};
+
+/**
+* State shared by the threads of the server
+*/
+struct ServerState {
+  BoundedQueue<ServerJob> jobs;
+  LatencyLog latencies;
+  FilterMode filter;
+  MaskOutput output;
+  int listenFd;
+  atomic<bool> stopping;
+  mutex connectionsMutex;
+  set<int> openFds; // sockets of the connections being read
+  atomic<int> readers;
+  mutex bytesMutex;
+  condition_variable bytesFreed;
+  long long queuedBytes; // encoded images read and not yet decoded
+
+  explicit ServerState(int capacity) : jobs(capacity), listenFd(-1), stopping(false), readers(0), queuedBytes(0){}
+
+  /**
+  * Waits until n more bytes fit in serverQueueBytes. A payload is always accepted by an empty queue. Returns false
+  * if the server is stopping
+  */
+  bool reserveBytes(long long n){
+    unique_lock<mutex> lock(bytesMutex);
+    bytesFreed.wait(lock, [&]{ return stopping || queuedBytes == 0 || queuedBytes + n <= serverQueueBytes; });
+    if(stopping){
+      return false;
+    }
+    queuedBytes += n;
+    return true;
+  }
+
+  void releaseBytes(long long n){
+    lock_guard<mutex> lock(bytesMutex);
+    queuedBytes -= n;
+    bytesFreed.notify_all();
+  }
+
+  /**
+  * Stops accepting connections and wakes up the readers, so that the queue can be closed
+  */
+  void stop(){
+    if(stopping.exchange(true)){
+      return;
+    }
+    if(listenFd >= 0){
+      shutdown(listenFd, SHUT_RDWR);
+    }
+    {
+      lock_guard<mutex> lock(bytesMutex);
+      bytesFreed.notify_all();
+    }
+    lock_guard<mutex> lock(connectionsMutex);
+    for(set<int>::iterator fd = openFds.begin(); fd != openFds.end(); fd++){
+      shutdown(*fd, SHUT_RD);
+    }
+  }
+};
+
+static double msSince(const chrono::time_point<chrono::steady_clock>& from){
+  return chrono::duration_cast<chrono::microseconds> (chrono::steady_clock::now() - from).count() / 1000.;
+}
+
+/**
+* Reads a positive decimal number not above limit
+*/
+static bool parsePositive(const string& word, long long limit, long long& value){
+  char* end = 0;
+  errno = 0;
+  value = strtoll(word.c_str(), &end, 10);
+  return !word.empty() && *end == '\0' && errno == 0 && value > 0 && value <= limit;
+}
+
+/**
+* Parses the requests of a connection until it is closed. Detections are queued, the other requests are answered
+* right away
+*/
+static void readRequests(ServerState& state, shared_ptr<Connection> connection){
+  LineReader reader(connection->inFd);
+  string line;
+  while(!state.stopping && reader.readLine(line, maxLineLength)){
+    chrono::time_point<chrono::steady_clock> received = chrono::steady_clock::now();
+    if(line.size() > maxLineLength){
+      // the end of the line is unknown, so the stream is lost
+      connection->reply("ERR - line too long\n");
+      break;
+    }
+    stringstream sstm(line);
+    string command;
+    sstm >> command;
+
+    if(command == "STATS"){
+      connection->reply(state.latencies.summary() + "\n");
+      continue;
+    }
+    if(command == "SHUTDOWN"){
+      connection->reply("OK\n");
+      state.stop();
+      break;
+    }
+    if(command != "DETECT"){
+      if(!command.empty()){
+        connection->reply("ERR - unknown command " + command + "\n");
+      }
+      continue;
+    }
+
+    vector<string> words; // id, steps, kind, path or size, mask path
+    string word;
+    while(sstm >> word){
+      words.push_back(word);
+    }
+
+    ServerJob job;
+    job.connection = connection;
+    job.config.filter = state.filter;
+    job.id = words.empty() ? "-" : words[0];
+    bool wellFormed = words.size() == 7;
+    long long payloadBytes = 0;
+    if(find(words.begin(), words.end(), "BYTES") != words.end()){
+      // the payload is read before the rest of the line is checked, so that it is never parsed as requests
+      if(!wellFormed || words[4] != "BYTES" || !parsePositive(words[5], maxPayloadBytes, payloadBytes)){
+        connection->reply("ERR " + job.id + " bad payload size\n");
+        break;
+      }
+      if(!state.reserveBytes(payloadBytes)){
+        connection->reply("ERR " + job.id + " server is stopping\n");
+        break;
+      }
+      job.encoded.create(1, (int) payloadBytes, CV_8UC1);
+      if(!reader.readBytes(payloadBytes, job.encoded.ptr<uchar>(0))){
+        state.releaseBytes(payloadBytes);
+        break;
+      }
+    }
+    else{
+      wellFormed = wellFormed && words[4] == "PATH";
+      if(wellFormed){
+        job.inputPath = words[5];
+      }
+    }
+    job.received = received;
+
+    long long steps[3];
+    for(int k = 0; k < 3 && wellFormed; k++){
+      wellFormed = parsePositive(words[1 + k], INT_MAX, steps[k]);
+    }
+    if(wellFormed){
+      job.config.lStep = steps[0];
+      job.config.aStep = steps[1];
+      job.config.bStep = steps[2];
+      job.maskPath = words[6];
+    }
+    if(!wellFormed || !validConfig(job.config)){
+      connection->reply("ERR " + job.id + " malformed request\n");
+      state.releaseBytes(payloadBytes);
+      continue;
+    }
+    job.queued = chrono::steady_clock::now();
+    if(!state.jobs.push(job)){
+      connection->reply("ERR " + job.id + " server is stopping\n");
+      state.releaseBytes(payloadBytes);
+      break;
+    }
+  }
+}
+
+/**
+* Pops requests and answers them. The detector keeps its buffers between requests
+*/
+static void serveJobs(ServerState& state, TaskScheduler& scheduler){
+  ShadowDetector detector(ShadowConfig(), scheduler);
+  Mat img, mask;
+  ServerJob job;
+  while(state.jobs.pop(job)){
+    double queueMs = msSince(job.queued);
+    string error;
+    DetectStats stats;
+
+    {
+      PROFILE_SCOPE("load");
+      img = job.inputPath.empty() ? imdecode(job.encoded, IMREAD_COLOR) : imread(job.inputPath);
+    }
+    if(!job.encoded.empty()){
+      state.releaseBytes(job.encoded.total());
+      job.encoded.release();
+    }
+    if(img.empty()){
+      error = "can not decode the image";
+    }
+    else if(!detector.configure(job.config) || !detector.detect(img, mask, &stats)){
+      error = "detection failed";
+    }
+    else if(job.maskPath != "-" && !writeMask(job.maskPath, mask, state.output)){
+      error = "can not write " + job.maskPath;
+    }
+
+    double latencyMs = msSince(job.received);
+    stringstream sstm;
+    if(error.empty()){
+      state.latencies.add(latencyMs);
+      sstm << "OK " << job.id << " " << countNonZero(mask) << " " << latencyMs << " " << queueMs << "\n";
+    }
+    else{
+      sstm << "ERR " << job.id << " " << error << "\n";
+    }
+    job.connection->reply(sstm.str());
+    job.connection.reset();
+  }
+}
+
+/**
+* This function runs the server until its input is closed (standard input) or a SHUTDOWN request is received
+* (socket).
+*
+* @param address path of the Unix domain socket, or "-" for the standard input and output
+* @param workers number of requests processed at the same time
+* @param filter edge preserving filter. See ShadowPipeline.cpp
+* @param output format of the written masks. See MaskWriter.cpp
+* @return 0 on success, 1 if the socket can not be created
+*/
+int runServer(const string& address, int workers, FilterMode filter, const MaskOutput& output){
+  // a client that closes its connection must not kill the server
+  signal(SIGPIPE, SIG_IGN);
+
+  ServerState state(serverQueueCapacity);
+  state.filter = filter;
+  state.output = output;
+
+  // threads and buffers are created once. The scheduler is shared by all workers
+  TaskScheduler scheduler;
+  vector<thread> threads;
+  for(int w = 0; w < workers; w++){
+    threads.push_back(thread([&]{ serveJobs(state, scheduler); }));
+  }
+  cerr << "Server ready on " << (address == "-" ? "standard input" : address) << ". Workers: " << workers
+       << ", threads: " << scheduler.size() << endl;
+
+  if(address == "-"){
+    readRequests(state, make_shared<Connection>(STDIN_FILENO, STDOUT_FILENO, false));
+  }
+  else{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(address.size() >= sizeof(addr.sun_path)){
+      cerr << "Socket path too long: " << address << endl;
+      state.jobs.close();
+      for(int t = 0; t < threads.size(); t++){
+        threads[t].join();
+      }
+      return 1;
+    }
+    strcpy(addr.sun_path, address.c_str());
+
+    // only the socket left by a previous run is removed, never a file that happens to have the same path
+    struct stat info;
+    if(lstat(address.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)){
+      unlink(address.c_str());
+    }
+
+    state.listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(state.listenFd < 0 || ::bind(state.listenFd, (struct sockaddr*) &addr, sizeof(addr)) != 0
+        || listen(state.listenFd, serverBacklog) != 0){
+      cerr << "Can not listen on " << address << endl;
+      state.jobs.close();
+      for(int t = 0; t < threads.size(); t++){
+        threads[t].join();
+      }
+      return 1;
+    }
+
+    // one reader per connection. Readers are detached and counted, so that the queue is closed after the last one
+    mutex readersMutex;
+    condition_variable readersDone;
+    while(!state.stopping){
+      int fd = accept(state.listenFd, 0, 0);
+      if(fd < 0){
+        if(errno == EINTR){
+          continue;
+        }
+        break;
+      }
+      {
+        lock_guard<mutex> lock(state.connectionsMutex);
+        if(state.stopping){
+          close(fd);
+          break;
+        }
+        state.openFds.insert(fd);
+      }
+      state.readers++;
+      thread([&, fd]{
+        shared_ptr<Connection> connection = make_shared<Connection>(fd, fd, true);
+        readRequests(state, connection);
+        {
+          // the socket is closed with the last reference, so it must leave the set first
+          lock_guard<mutex> lock(state.connectionsMutex);
+          state.openFds.erase(fd);
+        }
+        connection.reset();
+        lock_guard<mutex> lock(readersMutex);
+        state.readers--;
+        readersDone.notify_all();
+      }).detach();
+    }
+    state.stop();
+
+    unique_lock<mutex> lock(readersMutex);
+    readersDone.wait(lock, [&]{ return state.readers == 0; });
+    close(state.listenFd);
+    unlink(address.c_str());
+  }
+
+  // let the workers finish the queued requests
+  state.jobs.close();
+  for(int t = 0; t < threads.size(); t++){
+    threads[t].join();
+  }
+
+  cerr << "Server stopped. " << state.latencies.summary() << " (requests, p50, p95, p99, max ms)" << endl;
+  return 0;
+}
@@ -0,0 +1,113 @@
+/**
+ * @file ShadowDetector.cpp
+ * The goal of the code in this file is to expose the pipeline as a library. A ShadowDetector is created once
+ * and then called on many images: the caller passes a pointer to its own pixels with their stride and channel
+ * order, and a buffer that receives the mask. Both are wrapped in Mat headers, so that no pixel is copied
+ * in or out, and every intermediate buffer is kept by the detector and reused by the next call.
+ *
+ * @author Martini Davide
+ * @version 1.1
+ * @since 1.1
+ *
+ */
+
+#include "ShadowDetector.h"
+
+/**
+* Returns true if all the steps of config are positive
+*/
+bool validConfig(const ShadowConfig& config){
+  return config.lStep > 0 && config.aStep > 0 && config.bStep > 0;
+}
+
+/**
+* Creates a detector with its own pool of config.threads threads
+*/
+ShadowDetector::ShadowDetector(const ShadowConfig& config)
+  : cfg(config), ownPool(new TaskScheduler(config.threads)), pool(ownPool.get()){
+  if(validConfig(cfg)){
+    makeBinLayout(cfg.lStep, cfg.aStep, cfg.bStep, layout);
+  }
+}
+
+/**
+* Creates a detector that runs its tasks on a pool shared with other detectors. The pool must outlive the detector
+*/
+ShadowDetector::ShadowDetector(const ShadowConfig& config, TaskScheduler& scheduler)
+  : cfg(config), pool(&scheduler){
+  if(validConfig(cfg)){
+    makeBinLayout(cfg.lStep, cfg.aStep, cfg.bStep, layout);
+  }
+}
+
+/**
+* Changes steps and filter, keeping the buffers. The number of threads of the pool can not be changed
+*
+* @param config new configuration
+* @return false if a step is not positive. The configuration is not changed in that case
+*/
+bool ShadowDetector::configure(const ShadowConfig& config){
+  if(!validConfig(config)){
+    return false;
+  }
+  if(config.lStep != cfg.lStep || config.aStep != cfg.aStep || config.bStep != cfg.bStep || !validConfig(cfg)){
+    makeBinLayout(config.lStep, config.aStep, config.bStep, layout);
+  }
+  cfg.lStep = config.lStep;
+  cfg.aStep = config.aStep;
+  cfg.bStep = config.bStep;
+  cfg.filter = config.filter;
+  return true;
+}
+
+/**
+* This function detects the shadow pixels of an image owned by the caller.
+* The channel order is taken into account so that every format gives the same mask that the command line tool
+* gives for the same picture.
+*
+* @param image input pixels. They are read in place
+* @param mask output buffer. It must have the size of image
+* @param stats if it is not null, it receives information about bins and components
+* @return false if a view is invalid or the configuration has a non positive step, true otherwise
+*/
+bool ShadowDetector::detect(const ImageView& image, const MaskView& mask, DetectStats* stats){
+  const int channels = (image.format == PIXEL_BGRA8 || image.format == PIXEL_RGBA8) ? 4 : 3;
+  if(image.data == 0 || mask.data == 0 || image.width <= 0 || image.height <= 0
+      || image.stride < (size_t) image.width * channels || mask.width != image.width || mask.height != image.height
+      || mask.stride < (size_t) mask.width){
+    return false;
+  }
+
+  // the command line tool converts imread() images, which are BGR, with COLOR_RGB2Lab. The same pixels
+  // in RGB order are converted with the swapped code. cvtColor() ignores the alpha channel
+  const int conversion = (image.format == PIXEL_BGR8 || image.format == PIXEL_BGRA8) ? COLOR_RGB2Lab : COLOR_BGR2Lab;
+  Mat img(image.height, image.width, CV_8UC(channels), (void*) image.data, image.stride);
+  Mat maskFinal(mask.height, mask.width, CV_8UC1, mask.data, mask.stride);
+  return run(img, conversion, maskFinal, stats);
+}
+
+/**
+* This function detects the shadow pixels of an image returned by imread().
+*
+* @param img input BGR image
+* @param mask output CV_8UC1 mask. If it already has the size of img, it is written in place
+* @param stats if it is not null, it receives information about bins and components
+* @return false if img is empty or not a 3 channel 8 bit image, or the configuration has a non positive step
+*/
+bool ShadowDetector::detect(const Mat& img, Mat& mask, DetectStats* stats){
+  if(img.empty() || img.type() != CV_8UC3){
+    return false;
+  }
+  return run(img, COLOR_RGB2Lab, mask, stats);
+}
+
+bool ShadowDetector::run(const Mat& img, int conversion, Mat& mask, DetectStats* stats){
+  if(!validConfig(cfg)){
+    return false;
+  }
+
+  // See ShadowPipeline.cpp. The front end computes the bins as well, since the steps are known
+  computeFrontEnd(img, fe, &layout, cfg.filter, conversion);
+  detectShadows(fe, cfg.lStep, cfg.aStep, cfg.bStep, *pool, mask, stats, &scratch);
+  return true;
+}
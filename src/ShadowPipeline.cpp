@@ -0,0 +1,350 @@
+/**
+ * @file ShadowPipeline.cpp
+ * The goal of the code in this file is to provide the two halves of the shadow detection.
+ * computeFrontEnd() converts the input image to the CIE L*a*b* color space, filters it and
+ * computes the PSP mask. None of these stages depend on the steps used to group colors, so
+ * their result can be shared by many calls to detectShadows(), which bins the PSP, labels
+ * them and analyzes every component to build the final mask.
+ *
+ * @author Martini Davide
+ * @version 1.1
+ * @since 1.1
+ *
+ */
+
+#include "ShadowPipeline.h"
+
+/**
+* Task of the border test: a range of components of the same bin or, for a component larger than a task,
+* a range of its runs
+*/
+struct BorderTask {
+  int cost; // pixels analyzed
+  int comp; // component whose runs are analyzed, -1 for a range of components
+  int begin; // first component, or first run, of the range
+  int end; // component, or run, after the last one of the range
+
+  bool operator>(const BorderTask& other) const{
+    return cost > other.cost;
+  }
+};
+
+/**
+* This function applies the edge preserving filter to the l*a*b* image and splits it in planes.
+* FILTER_BILATERAL filters each plane on its own, as the reference pipeline does. FILTER_JOINT runs a single
+* bilateral filter over the interleaved image, so the range weight of a neighbour depends on its distance in
+* all three channels and the neighbourhood is visited once. FILTER_HALF does the same at half resolution and
+* upsamples the result, trading accuracy on thin edges for speed. See results/filter_comparison.md for measures.
+*
+* @param imgLAB CV_8UC3 l*a*b* image
+* @param filter filter mode
+* @param imgL output filtered l* component
+* @param imgA output filtered a* component
+* @param imgB output filtered b* component
+* @param scratch if it is not null, its buffers are used instead of allocating new ones
+*/
+void filterLab(const Mat& imgLAB, FilterMode filter, Mat& imgL, Mat& imgA, Mat& imgB, FilterScratch* scratch){
+  FilterScratch localScratch;
+  FilterScratch& buffers = (scratch != 0) ? *scratch : localScratch;
+
+  if(filter == FILTER_BILATERAL){
+    split(imgLAB, buffers.channels);
+
+    //bilateral filter to reduce noise but preserve edges
+    bilateralFilter(buffers.channels[0], imgL, 5, 80, 80);
+    bilateralFilter(buffers.channels[1], imgA, 5, 80, 80);
+    bilateralFilter(buffers.channels[2], imgB, 5, 80, 80);
+    return;
+  }
+
+  if(filter == FILTER_JOINT){
+    bilateralFilter(imgLAB, buffers.filtered, 5, 80, 80);
+  }
+  else{
+    // at half resolution a diameter of 3 covers about the same neighbourhood as 5 at full resolution
+    resize(imgLAB, buffers.small, Size((imgLAB.cols + 1) / 2, (imgLAB.rows + 1) / 2), 0, 0, INTER_AREA);
+    bilateralFilter(buffers.small, buffers.smallFiltered, 3, 80, 80);
+    resize(buffers.smallFiltered, buffers.filtered, imgLAB.size(), 0, 0, INTER_LINEAR);
+  }
+
+  // the planes are split straight into the output buffers, which are reused if they have the right size
+  imgL.create(imgLAB.size(), CV_8UC1);
+  imgA.create(imgLAB.size(), CV_8UC1);
+  imgB.create(imgLAB.size(), CV_8UC1);
+  Mat planes[3] = {imgL, imgA, imgB};
+  split(buffers.filtered, planes);
+}
+
+/**
+* This function computes the stages of the pipeline that do not depend on lStep, aStep and bStep.
+* Statistics come from the lightness histogram, then the PSP mask is written by a vectorized kernel.
+* If the steps are already known, the bins are computed in the same pass. See FrontEndKernels.cpp.
+*
+* @param imgRGB input image, as returned by imread()
+* @param fe output filtered planes, lightness statistics and PSP mask
+* @param layout if it is not null, the bin image is computed as well and stored in fe
+* @param filter edge preserving filter. See filterLab()
+* @param conversion cvtColor() code from the channel order of imgRGB to CIE LAB. Images returned by imread()
+* use the default
+*/
+void computeFrontEnd(const Mat& imgRGB, FrontEnd& fe, const BinLayout* layout, FilterMode filter, int conversion){
+  addCounter(COUNTER_IMAGES, 1);
+
+  // in this process we use CIE LAB color space
+  {
+    PROFILE_SCOPE("lab");
+    cvtColor(imgRGB, fe.imgLAB, conversion);
+  }
+
+  // filter to reduce noise but preserve edges
+  {
+    PROFILE_SCOPE("filter");
+    filterLab(fe.imgLAB, filter, fe.imgL, fe.imgA, fe.imgB, &fe.filterScratch);
+  }
+
+  // compute the mean and the standard deviation of the luminance component
+  // these values are considered as the "background light" so they allow to
+  // distinguish "probably shadow pixels" (PSP) from surely "not shadow pixels" (NSP)
+  {
+    PROFILE_SCOPE("statistics");
+    int hist[256];
+    lightnessHistogram(fe.imgL, hist);
+    lightnessStats(hist, fe.meanL, fe.stdDevL);
+    fe.useSTD = true;
+    if(fe.stdDevL <  (double) 255 / 6){
+      fe.useSTD = false;
+    }
+  }
+
+  // depending on the standard deviation on imgL, each pixel with lightness component less than meanL - stdDevL/3
+  // or simply meanL is a PSP, otherwise it is a NSP.
+  // in the resulting masks, each PSP value is set to the one assumed in the luminance image plus 1
+  // while each NSP remains set to 0
+  PROFILE_SCOPE("mask");
+  const int threshold = lightnessThreshold(fe.useSTD ? fe.meanL - fe.stdDevL / 3 : fe.meanL);
+  fe.maskAvgL.create(fe.imgL.size(), CV_8UC1);
+  fe.maskPixels = 0;
+
+  if(layout != 0){
+    fe.layout = *layout;
+    fe.binImg.create(fe.imgL.size(), CV_32SC1);
+    for(int i = 0; i < fe.imgL.rows; i++){
+      fe.maskPixels += maskAndBinsRow(fe.imgL.ptr<uchar>(i), fe.imgA.ptr<uchar>(i), fe.imgB.ptr<uchar>(i), fe.imgL.cols,
+          threshold, *layout, fe.maskAvgL.ptr<uchar>(i), fe.binImg.ptr<int>(i));
+    }
+  }
+  else{
+    fe.binImg.release();
+    for(int i = 0; i < fe.imgL.rows; i++){
+      fe.maskPixels += maskRow(fe.imgL.ptr<uchar>(i), fe.imgL.cols, threshold, fe.maskAvgL.ptr<uchar>(i));
+    }
+  }
+}
+
+/**
+* This function runs the border test of findShadow() on the components of cs, spread over the scheduler.
+*
+* @param binImg bin of each pixel of the filtered input image
+* @param layout bin layout used to compute binImg
+* @param cs connected components of the image
+* @param selected if it is not null, only the components whose entry is not 0 are tested
+* @param scheduler pool of threads that analyzes the components. See TaskScheduler.cpp for more details
+* @param shadow decision of each component, 1 for shadows and 0 otherwise. It must have an entry per component.
+* Entries of the components that are not tested are left unchanged
+*/
+void testBorders(const Mat& binImg, const BinLayout& layout, const ComponentSet& cs, const vector<uchar>* selected,
+    TaskScheduler& scheduler, vector<uchar>& shadow){
+
+  // split the work in tasks. The cost of a task is estimated by the number of pixels it analyzes.
+  // Bins much larger than the average share of a thread are split in runs of consecutive components:
+  // components of a bin are stored in raster order, so each sub-task covers a horizontal band of the image.
+  // A single component larger than that is split in bands of its own runs, whose results are merged below
+  long long pixels = 0;
+  for (int c = 0; c < cs.comps.size(); c++){
+    pixels += (selected == 0 || (*selected)[c]) ? cs.comps[c].area : 0;
+  }
+  const int maxTaskCost = (int) max(4096LL, pixels / (scheduler.size() * 8));
+  vector<BorderTask> ranges;
+  for (int g = 0; g < cs.groups.size(); g++){
+    const BinGroup& group = cs.groups[g];
+    const bool testable = binL(layout, cs.comps[group.firstComp].bin) > 0;
+    int begin = group.firstComp;
+    int cost = 0;
+    for (int c = group.firstComp; c < group.firstComp + group.numComps; c++){
+      const BinComponent& comp = cs.comps[c];
+      if(selected != 0 && !(*selected)[c]){
+        // a component that is not tested ends the range
+        if(c > begin){
+          BorderTask task = {cost, -1, begin, c};
+          ranges.push_back(task);
+        }
+        begin = c + 1;
+        cost = 0;
+        continue;
+      }
+      if(testable && comp.area > maxTaskCost){
+        if(c > begin){
+          BorderTask task = {cost, -1, begin, c};
+          ranges.push_back(task);
+        }
+        shadow[c] = 0; // set below if a part finds a lighter border pixel
+        int runBegin = comp.firstRun;
+        int runCost = 0;
+        for (int r = comp.firstRun; r < comp.firstRun + comp.numRuns; r++){
+          if(runCost > 0 && runCost + cs.runs[r].colEnd - cs.runs[r].colBegin > maxTaskCost){
+            BorderTask task = {runCost, c, runBegin, r};
+            ranges.push_back(task);
+            runBegin = r;
+            runCost = 0;
+          }
+          runCost = runCost + cs.runs[r].colEnd - cs.runs[r].colBegin;
+        }
+        BorderTask task = {runCost, c, runBegin, comp.firstRun + comp.numRuns};
+        ranges.push_back(task);
+        begin = c + 1;
+        cost = 0;
+        continue;
+      }
+      if(cost > 0 && cost + comp.area > maxTaskCost){
+        BorderTask task = {cost, -1, begin, c};
+        ranges.push_back(task);
+        begin = c;
+        cost = 0;
+      }
+      cost = cost + comp.area;
+    }
+    if(begin < group.firstComp + group.numComps){
+      BorderTask task = {cost, -1, begin, group.firstComp + group.numComps};
+      ranges.push_back(task);
+    }
+  }
+
+  // largest tasks first, so that the biggest bins do not end up at the tail of the run
+  stable_sort(ranges.begin(), ranges.end(), greater<BorderTask>());
+
+  vector<uchar> partial(ranges.size(), 0); // result of each part of a split component
+  vector<function<void()> > tasks;
+  for (int t = 0; t < ranges.size(); t++){
+    const BorderTask& task = ranges[t];
+    if(task.comp < 0){
+      // See FindShadow.cpp for more information
+      tasks.push_back([&, task]{ findShadow(binImg, layout, cs, task.begin, task.end, shadow); });
+    }
+    else{
+      tasks.push_back([&, task, t]{ partial[t] = isShadowPart(binImg, layout, cs, task.comp, task.begin, task.end); });
+    }
+  }
+  scheduler.run(tasks);
+
+  // a split component is a shadow if any of its parts found a lighter border pixel
+  int splitShadows = 0;
+  for (int t = 0; t < ranges.size(); t++){
+    if(ranges[t].comp >= 0 && partial[t] && !shadow[ranges[t].comp]){
+      shadow[ranges[t].comp] = 1;
+      splitShadows++;
+    }
+  }
+  addCounter(COUNTER_SHADOW_COMPONENTS, splitShadows);
+  addCounter(COUNTER_EARLY_EXITS, splitShadows);
+}
+
+/**
+* This function detects the shadow pixels (SP) among the PSP. Each pixel is assigned to a color bin given by
+* its (l*, a*, b*) components, then the PSP with equal bin are labeled in a single pass and each component
+* is analyzed by findShadow(). The work is split in tasks executed by the scheduler.
+*
+* @param fe output of computeFrontEnd(). Its bin image is used if it was computed with the same steps
+* @param lStep step used to group l* components. It must be positive
+* @param aStep step used to group a* components. It must be positive
+* @param bStep step used to group b* components. It must be positive
+* @param scheduler pool of threads that analyzes the components. See TaskScheduler.cpp for more details
+* @param maskFinal output CV_8UC1 mask. Each SP is set to 255, every other pixel to 0
+* @param stats if it is not null, it receives information about bins and components
+* @param scratch if it is not null, its buffers are used instead of allocating new ones. A scratch must not be
+* shared by concurrent calls
+*/
+void detectShadows(const FrontEnd& fe, int lStep, int aStep, int bStep, TaskScheduler& scheduler,
+    Mat& maskFinal, DetectStats* stats, DetectScratch* scratch){
+
+  DetectScratch localScratch;
+  DetectScratch& buffers = (scratch != 0) ? *scratch : localScratch;
+
+  // See BinIndex.cpp for more information. Bins may have been computed already by the front end
+  BinLayout layout;
+  makeBinLayout(lStep, aStep, bStep, layout);
+  Mat binImg;
+  BinIndex& index = buffers.index;
+  {
+    PROFILE_SCOPE("binning");
+    if(!fe.binImg.empty() && fe.layout.lStep == lStep && fe.layout.aStep == aStep && fe.layout.bStep == bStep){
+      binImg = fe.binImg;
+    }
+    else{
+      quantizeBins(fe.imgL, fe.imgA, fe.imgB, layout, buffers.binImg);
+      binImg = buffers.binImg;
+    }
+
+    // group the PSP by bin
+    buildBinIndex(binImg, fe.maskAvgL, layout, index);
+  }
+
+  // label the PSP with equal bin in a single pass. See LabelBins.cpp for more information
+  ComponentSet& cs = buffers.cs;
+  {
+    PROFILE_SCOPE("labeling");
+    labelBins(index, binImg.cols, cs);
+  }
+  addCounter(COUNTER_BINS, index.bins.size());
+  addCounter(COUNTER_COMPONENTS, cs.comps.size());
+
+  if(stats != 0){
+    stats->bins = index.bins.size();
+    stats->components = cs.comps.size();
+    stats->indexedPixels = index.pixels.size();
+  }
+
+  vector<uchar>& shadow = buffers.shadow;
+  shadow.assign(cs.comps.size(), 0);
+  testBorders(binImg, layout, cs, 0, scheduler, shadow);
+
+  // write the final result. A mask of the right size and type is written in place, so it may wrap a caller buffer
+  maskFinal.create(fe.maskAvgL.size(), CV_8UC1);
+  maskFinal.setTo(Scalar(0));
+  paintShadows(cs, shadow, maskFinal);
+}
+
+/**
+* Returns the file name, without extension, of the final mask computed with the given steps. See MaskWriter.cpp
+*/
+string maskName(int lStep, int aStep, int bStep){
+  stringstream sstm;
+  sstm << "mask_step_two_lStep" << lStep << "_aStep" << aStep << "_bStep" << bStep;
+  return sstm.str();
+}
+
+/**
+* Parses the name of a filter mode: "bilateral", "joint" or "half"
+*/
+bool parseFilterMode(const string& name, FilterMode& filter){
+  if(name == "bilateral"){
+    filter = FILTER_BILATERAL;
+  }
+  else if(name == "joint"){
+    filter = FILTER_JOINT;
+  }
+  else if(name == "half"){
+    filter = FILTER_HALF;
+  }
+  else{
+    return false;
+  }
+  return true;
+}
+
+string filterModeName(FilterMode filter){
+  switch(filter){
+    case FILTER_JOINT: return "joint";
+    case FILTER_HALF: return "half";
+    default: return "bilateral";
+  }
+}
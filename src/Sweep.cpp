@@ -0,0 +1,187 @@
+/**
+ * @file Sweep.cpp
+ * The goal of the code in this file is to evaluate many (lStep, aStep, bStep) triples on the
+ * same image. The stages that do not depend on the steps (decoding, color conversion,
+ * filtering and PSP mask) are computed once, then every triple is evaluated in parallel
+ * against the cached planes and one mask is written per triple.
+ *
+ * @author Martini Davide
+ * @version 1.1
+ * @since 1.1
+ *
+ */
+
+#include "Sweep.h"
+
+#include <set>
+#include <tuple>
+
+const int maxStep = 256; // every step from 256 on puts all values in bin 0. See makeBinLayout()
+const int maxTriples = 65536; // each triple writes a mask, so larger sweeps are refused
+
+/**
+* Parses a value of a triple: either a single number "v", a range "from:to" or a range with step "from:to:by".
+* Ranges include both ends. Values must be in [1, maxStep]
+*/
+static bool parseValues(const string& item, vector<int>& values){
+  vector<int> parts;
+  stringstream ss(item);
+  string part;
+  while(getline(ss, part, ':')){
+    char* end = 0;
+    long v = strtol(part.c_str(), &end, 10);
+    if(part.empty() || *end != '\0' || v <= 0 || v > maxStep){
+      return false;
+    }
+    parts.push_back(v);
+  }
+
+  if(parts.size() == 1){
+    values.push_back(parts[0]);
+    return true;
+  }
+  if(parts.size() < 2 || parts.size() > 3 || parts[1] < parts[0]){
+    return false;
+  }
+
+  int by = (parts.size() == 3) ? parts[2] : 1;
+  for(int v = parts[0]; v <= parts[1]; v += by){
+    values.push_back(v);
+  }
+  return true;
+}
+
+/**
+* This function parses the list of triples to evaluate. Triples are separated by ';' and their three steps by ',',
+* for example "20,50,50;10,10,10". Each step can also be a range: "10:60:10,10,10" stands for the six triples
+* (10, 10, 10), (20, 10, 10), ..., (60, 10, 10), and "5:20:5,10:50:20,10:50:20" for the whole grid.
+* Steps can not exceed maxStep. Repeated triples are evaluated only once.
+*
+* @param spec list of triples
+* @param triples output triples, in the order they appear in spec
+* @return false if spec is not well formed or it has more than maxTriples triples
+*/
+bool parseSweep(const string& spec, vector<StepTriple>& triples){
+  triples.clear();
+  set<tuple<int, int, int> > seen;
+
+  stringstream entries(spec);
+  string entry;
+  while(getline(entries, entry, ';')){
+    vector<string> items;
+    stringstream ss(entry);
+    string item;
+    while(getline(ss, item, ',')){
+      items.push_back(item);
+    }
+    if(items.size() != 3){
+      return false;
+    }
+
+    vector<int> lValues, aValues, bValues;
+    if(!parseValues(items[0], lValues) || !parseValues(items[1], aValues) || !parseValues(items[2], bValues)){
+      return false;
+    }
+
+    // the grid can hold up to maxStep^3 triples, so its size is checked before it is expanded
+    const long long grid = (long long) lValues.size() * aValues.size() * bValues.size();
+    if(grid > maxTriples){
+      return false;
+    }
+
+    for(int l = 0; l < lValues.size(); l++){
+      for(int a = 0; a < aValues.size(); a++){
+        for(int b = 0; b < bValues.size(); b++){
+          if(seen.insert(make_tuple(lValues[l], aValues[a], bValues[b])).second){
+            StepTriple t = {lValues[l], aValues[a], bValues[b]};
+            triples.push_back(t);
+          }
+        }
+      }
+    }
+    if(triples.size() > maxTriples){
+      return false;
+    }
+  }
+
+  return !triples.empty();
+}
+
+/**
+* This function runs the sweep. The front end is computed once, then one task per thread takes the triples in
+* turn, calls detectShadows() with its own scratch and writes the mask. At most one triple per thread is in
+* flight, so the memory does not grow with the number of triples. Triples also spread their own components
+* over the scheduler, so threads stay busy when there are fewer triples than threads.
+*
+* @param srcPath input image path
+* @param triples steps to evaluate. See parseSweep()
+* @param filter edge preserving filter. See ShadowPipeline.cpp
+* @param output format of the masks. See MaskWriter.cpp
+* @param scheduler pool of threads. See TaskScheduler.cpp for more details
+* @return 0 on success, 1 if the input image can not be opened
+*/
+int runSweep(const string& srcPath, const vector<StepTriple>& triples, FilterMode filter, const MaskOutput& output,
+    TaskScheduler& scheduler){
+  chrono::time_point<chrono::system_clock> start, end;
+  start = chrono::system_clock::now();
+
+  Mat imgRGB;
+  {
+    PROFILE_SCOPE("load");
+    imgRGB = imread(srcPath);
+  }
+  if(imgRGB.empty()){
+    cout << "Wrong argument! Can not open input image. Check for errors in the provided path" << endl;
+    return 1;
+  }
+
+  FrontEnd fe;
+  computeFrontEnd(imgRGB, fe, 0, filter);
+  imgRGB.release();
+  if(output.intermediate){
+    writeMask("../results/mask_step_one" + maskExtension(output.format), fe.maskAvgL, output, false);
+  }
+
+  end = chrono::system_clock::now();
+  int frontEndMs = chrono::duration_cast<std::chrono::milliseconds> (end-start).count();
+  cout << "Front end done in " << frontEndMs << " ms. Mean lightness value: " << fe.meanL
+       << ", standard deviation: " << fe.stdDevL << " useSTD: " << fe.useSTD << endl;
+
+  // evaluate all triples. Each triple is taken by one task, which writes only its entries
+  vector<DetectStats> stats(triples.size());
+  vector<int> shadowPixels(triples.size());
+  vector<int> elapsed(triples.size());
+  atomic<int> next(0);
+  vector<function<void()> > tasks;
+  for(int w = 0; w < min((int) triples.size(), scheduler.size()); w++){
+    tasks.push_back([&]{
+      DetectScratch scratch;
+      Mat maskFinal;
+      for(int t = next++; t < triples.size(); t = next++){
+        chrono::time_point<chrono::system_clock> Tstart = chrono::system_clock::now();
+
+        detectShadows(fe, triples[t].lStep, triples[t].aStep, triples[t].bStep, scheduler, maskFinal, &stats[t],
+            &scratch);
+        shadowPixels[t] = countNonZero(maskFinal);
+        writeMask("../results/" + maskName(triples[t].lStep, triples[t].aStep, triples[t].bStep)
+            + maskExtension(output.format), maskFinal, output);
+
+        elapsed[t] = chrono::duration_cast<std::chrono::milliseconds> (chrono::system_clock::now() - Tstart).count();
+      }
+    });
+  }
+  scheduler.run(tasks);
+
+  // provide information to the user
+  cout << endl << "lStep aStep bStep -> bins, components, shadow pixels, time" << endl;
+  for(int t = 0; t < triples.size(); t++){
+    cout << triples[t].lStep << " " << triples[t].aStep << " " << triples[t].bStep << " -> " << stats[t].bins
+         << ", " << stats[t].components << ", " << shadowPixels[t] << ", " << elapsed[t] << " ms" << endl;
+  }
+
+  end = chrono::system_clock::now();
+  int elapsedMs = chrono::duration_cast<std::chrono::milliseconds> (end-start).count();
+  cout << "Evaluated " << triples.size() << " triples in " << elapsedMs << " ms" << endl;
+
+  return 0;
+}
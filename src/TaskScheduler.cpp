@@ -0,0 +1,194 @@
+/**
+ * @file TaskScheduler.cpp
+ * The goal of the code in this file is to provide a persistent pool of threads
+ * that execute batches of independent tasks. Each worker owns a deque of jobs:
+ * it takes jobs from the front of its own deque and, when it runs out of work,
+ * steals from the front of the other ones. Batches are queued by decreasing cost,
+ * so the front of a deque always holds its most expensive job and a thief takes
+ * the largest work left, as the owner would. Threads are created once and reused
+ * for every batch, so a slow task only delays the worker that runs it.
+ * A task can run a nested batch. While it waits, its thread only helps with the jobs of that batch and of the
+ * batches nested in it: running an unrelated job there would grow the stack without bound and delay the batch
+ * behind work it does not need.
+ *
+ * @author Martini Davide
+ * @version 1.1
+ * @since 1.1
+ *
+ */
+
+#include "TaskScheduler.h"
+
+static thread_local TaskScheduler* currentScheduler = 0; // scheduler owning the calling thread, if any
+static thread_local int currentWorker = -1; // index of the calling thread in its scheduler
+thread_local TaskScheduler::TaskGroup* TaskScheduler::runningGroup = 0;
+
+/**
+* Creates the pool.
+*
+* @param numThreads number of worker threads. If it is not positive, hardware_concurrency() is used
+*/
+TaskScheduler::TaskScheduler(int numThreads) : queued(0), stop(false){
+  if(numThreads <= 0){
+    numThreads = max(1, (int) thread::hardware_concurrency());
+  }
+
+  for(int w = 0; w < numThreads; w++){
+    workers.push_back(new Worker());
+  }
+  for(int w = 0; w < numThreads; w++){
+    threads.push_back(thread(&TaskScheduler::workerLoop, this, w));
+  }
+}
+
+TaskScheduler::~TaskScheduler(){
+  sleepMutex.lock();
+  stop = true;
+  sleepMutex.unlock();
+  wakeCv.notify_all();
+
+  for(int t = 0; t < threads.size(); t++){
+    threads[t].join();
+  }
+  for(int w = 0; w < workers.size(); w++){
+    delete workers[w];
+  }
+}
+
+int TaskScheduler::size() const{
+  return workers.size();
+}
+
+/**
+* This function executes all the tasks and returns when they are finished. Tasks should be sorted
+* by decreasing cost: they are dealt round robin to the workers, which run the most expensive ones first.
+* The calling thread helps executing the jobs of this batch, and of the batches nested in it, while it waits, so
+* run() can also be called from inside a task.
+* If a task throws, the first exception is rethrown once the whole batch is done.
+*
+* @param tasks tasks to execute. They must stay valid until run() returns
+*/
+void TaskScheduler::run(vector<function<void()> >& tasks){
+  if(tasks.empty()){
+    return;
+  }
+
+  TaskGroup group;
+  group.pending = tasks.size();
+  group.parent = runningGroup;
+
+  for(int t = 0; t < tasks.size(); t++){
+    Worker* worker = workers[t % workers.size()];
+    Job job = {&tasks[t], &group};
+    worker->m.lock();
+    worker->jobs.push_back(job);
+    worker->m.unlock();
+  }
+
+  sleepMutex.lock();
+  queued += tasks.size();
+  sleepMutex.unlock();
+  wakeCv.notify_all();
+
+  // help until the batch is finished
+  int self = (currentScheduler == this) ? currentWorker : -1;
+  while(group.pending > 0){
+    Job job;
+    if(takeJob(self, job, &group)){
+      execute(job);
+    }
+    else{
+      unique_lock<mutex> lock(group.doneMutex);
+      group.doneCv.wait(lock, [&group]{ return group.pending == 0; });
+    }
+  }
+
+  // wait for the last job to release the group
+  group.doneMutex.lock();
+  group.doneMutex.unlock();
+
+  if(group.error){
+    rethrow_exception(group.error);
+  }
+}
+
+/**
+* Removes from worker the first job that belongs to waited or to a batch nested in it. A null waited takes
+* the front job.
+*/
+bool TaskScheduler::popJob(Worker* worker, Job& job, const TaskGroup* waited){
+  lock_guard<mutex> lock(worker->m);
+  for(deque<Job>::iterator it = worker->jobs.begin(); it != worker->jobs.end(); it++){
+    const TaskGroup* group = it->group;
+    while(waited != 0 && group != 0 && group != waited){
+      group = group->parent;
+    }
+    if(waited == 0 || group == waited){
+      job = *it;
+      worker->jobs.erase(it);
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+* Takes a job from the front of the deque of worker w or, if it is empty, steals one from the front of
+* another deque, where the most expensive jobs are. A negative w only steals. If waited is not null, only the
+* jobs of that batch and of the batches nested in it are taken.
+*/
+bool TaskScheduler::takeJob(int w, Job& job, const TaskGroup* waited){
+  bool found = w >= 0 && popJob(workers[w], job, waited);
+  for(int k = 1; k <= workers.size() && !found; k++){
+    found = popJob(workers[(max(w, 0) + k) % workers.size()], job, waited);
+  }
+
+  if(found){
+    sleepMutex.lock();
+    queued--;
+    sleepMutex.unlock();
+  }
+  return found;
+}
+
+void TaskScheduler::execute(Job& job){
+  exception_ptr error;
+  TaskGroup* outer = runningGroup;
+  runningGroup = job.group;
+  try{
+    (*job.fn)();
+  }
+  catch(...){
+    error = current_exception();
+  }
+  runningGroup = outer;
+
+  // the last job wakes up the thread waiting in run(). The group lives on its stack,
+  // so it must not be touched after the lock is released
+  lock_guard<mutex> lock(job.group->doneMutex);
+  if(error && !job.group->error){
+    job.group->error = error;
+  }
+  if(--job.group->pending == 0){
+    job.group->doneCv.notify_all();
+  }
+}
+
+void TaskScheduler::workerLoop(int w){
+  currentScheduler = this;
+  currentWorker = w;
+
+  while(true){
+    Job job;
+    if(takeJob(w, job, 0)){
+      execute(job);
+      continue;
+    }
+
+    unique_lock<mutex> lock(sleepMutex);
+    wakeCv.wait(lock, [this]{ return stop || queued > 0; });
+    if(stop){
+      break;
+    }
+  }
+}
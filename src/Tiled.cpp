@@ -0,0 +1,407 @@
+/**
+ * @file Tiled.cpp
+ * The goal of the code in this file is to process images that do not fit in memory.
+ * The image is read in horizontal bands whose height follows from a memory budget, and
+ * each band is extended with a few overlapping rows so that filtering and the border
+ * test give the same result they give on the whole image. The work is done in three
+ * streaming passes:
+ * 1) the lightness histogram of all bands gives mean and standard deviation;
+ * 2) each band is binned and labeled, its components get global ids and a partial shadow
+ *    decision, and components crossing the seam with the previous band are merged with a
+ *    union-find. The runs of all components are spooled to a temporary file;
+ * 3) the runs are read back band by band and the mask is written to a PGM file row by row.
+ * A component is a shadow if one of its pixels has a lighter border pixel of the same color,
+ * so the decision of a merged component is the OR of the decisions of its parts.
+ *
+ * @author Martini Davide
+ * @version 1.1
+ * @since 1.1
+ *
+ */
+
+#include "Tiled.h"
+
+// extra rows read above and below a band. The bilateral filter needs 2 of them, the half resolution
+// filter a few more, and the border test one
+const int filterHalo = 8;
+
+// estimated bytes held per pixel of a band: input, Lab and filtered planes, mask, bins, bin index and runs
+const int bytesPerPixel = 48;
+
+/**
+* Reads the next token of a PPM header, skipping whitespaces and comments
+*/
+static bool readPpmToken(istream& in, string& token){
+  token.clear();
+  char c;
+  while(in.get(c)){
+    if(c == '#'){
+      string comment;
+      getline(in, comment);
+    }
+    else if(!isspace((unsigned char) c)){
+      token += c;
+      break;
+    }
+  }
+  while(in.get(c) && !isspace((unsigned char) c)){
+    token += c;
+  }
+  return !token.empty();
+}
+
+/**
+* Opens a binary PPM file and reads its header. Only 8 bit images (maxval 255) are supported
+*/
+bool PpmTileSource::open(const string& path){
+  file.open(path.c_str(), ios::binary);
+  string magic, w, h, maxval;
+  if(!file || !readPpmToken(file, magic) || magic != "P6" || !readPpmToken(file, w) || !readPpmToken(file, h)
+      || !readPpmToken(file, maxval) || maxval != "255"){
+    return false;
+  }
+
+  // a single whitespace after maxval has already been consumed by readPpmToken()
+  width = atoi(w.c_str());
+  height = atoi(h.c_str());
+  dataOffset = file.tellg();
+  return width > 0 && height > 0;
+}
+
+bool PpmTileSource::readRows(int y0, int y1, Mat& out){
+  out.create(y1 - y0, width, CV_8UC3);
+  file.clear();
+  file.seekg(dataOffset + (streamoff) y0 * width * 3);
+  for(int i = 0; i < out.rows; i++){
+    file.read((char*) out.ptr<uchar>(i), (streamsize) width * 3);
+  }
+  if(!file){
+    return false;
+  }
+
+  // PPM stores RGB, imread() returns BGR
+  cvtColor(out, out, COLOR_RGB2BGR);
+  return true;
+}
+
+bool MatTileSource::readRows(int y0, int y1, Mat& out){
+  out = img.rowRange(y0, y1);
+  return true;
+}
+
+/**
+* Reads, converts and filters rows [y0, y1). The rows around them are read as well and dropped after filtering,
+* so the result is the same as filtering the whole image.
+*/
+static bool filterRows(TileSource& source, int y0, int y1, FilterMode filter, Mat& imgL, Mat& imgA, Mat& imgB){
+  // even bounds keep the pixel pairs of the half resolution filter aligned with the whole image
+  const int rawY0 = max(y0 - filterHalo, 0) & ~1;
+  const int rawY1 = min((y1 + filterHalo + 1) & ~1, source.rows());
+
+  Mat raw, imgLAB;
+  {
+    PROFILE_SCOPE("load");
+    if(!source.readRows(rawY0, rawY1, raw)){
+      return false;
+    }
+  }
+  {
+    PROFILE_SCOPE("lab");
+    cvtColor(raw, imgLAB, COLOR_RGB2Lab);
+    raw.release();
+  }
+
+  Mat planeL, planeA, planeB;
+  {
+    PROFILE_SCOPE("filter");
+    filterLab(imgLAB, filter, planeL, planeA, planeB);
+  }
+  imgL = planeL.rowRange(y0 - rawY0, y1 - rawY0);
+  imgA = planeA.rowRange(y0 - rawY0, y1 - rawY0);
+  imgB = planeB.rowRange(y0 - rawY0, y1 - rawY0);
+  return true;
+}
+
+static int findRoot(vector<int>& parent, int g){
+  while(parent[g] != g){
+    parent[g] = parent[parent[g]]; // path halving
+    g = parent[g];
+  }
+  return g;
+}
+
+static void unite(TiledState& state, int a, int b){
+  a = findRoot(state.parent, a);
+  b = findRoot(state.parent, b);
+  if(a == b){
+    return;
+  }
+  if(b < a){
+    swap(a, b);
+  }
+  state.parent[b] = a;
+  state.shadow[a] = state.shadow[a] | state.shadow[b];
+  state.merges++;
+}
+
+/**
+* Collects the runs on a row of the band, sorted by column
+*/
+static void collectSeam(const ComponentSet& cs, int row, int base, vector<SeamRun>& seam){
+  seam.clear();
+  for(int c = 0; c < cs.comps.size(); c++){
+    const BinComponent& comp = cs.comps[c];
+    if(row < comp.bbox.y || row >= comp.bbox.y + comp.bbox.height){
+      continue;
+    }
+    for(int r = comp.firstRun; r < comp.firstRun + comp.numRuns; r++){
+      if(cs.runs[r].row == row){
+        SeamRun run = {cs.runs[r].colBegin, cs.runs[r].colEnd, comp.bin, base + c};
+        seam.push_back(run);
+      }
+    }
+  }
+  sort(seam.begin(), seam.end(), [](const SeamRun& x, const SeamRun& y){ return x.colBegin < y.colBegin; });
+}
+
+/**
+* This function labels a band and merges its components with the ones of the previous band.
+*
+* @param state state carried between bands
+* @param imgL filtered l* component of rows [extY0, extY0 + imgL.rows). They must include the row above
+* and the row below the band, unless the band touches the top or the bottom of the image
+* @param imgA filtered a* component of the same rows
+* @param imgB filtered b* component of the same rows
+* @param extY0 first row of the planes in the image
+* @param y0 first row of the band
+* @param y1 row after the last row of the band
+* @param scheduler pool of threads that analyzes the components. See TaskScheduler.cpp for more details
+*/
+void labelBand(TiledState& state, const Mat& imgL, const Mat& imgA, const Mat& imgB, int extY0, int y0, int y1,
+    TaskScheduler& scheduler){
+
+  // PSP mask and bins of the extended rows. Only the rows of the band are labeled
+  ComponentSet& cs = state.cs;
+  {
+    PROFILE_SCOPE("binning");
+    state.mask.create(imgL.size(), CV_8UC1);
+    state.binImg.create(imgL.size(), CV_32SC1);
+    for(int i = 0; i < imgL.rows; i++){
+      uchar* mask = state.mask.ptr<uchar>(i);
+      maskAndBinsRow(imgL.ptr<uchar>(i), imgA.ptr<uchar>(i), imgB.ptr<uchar>(i), imgL.cols, state.threshold, state.layout,
+          mask, state.binImg.ptr<int>(i));
+      if(extY0 + i < y0 || extY0 + i >= y1){
+        memset(mask, 0, imgL.cols);
+      }
+    }
+    buildBinIndex(state.binImg, state.mask, state.layout, state.index);
+  }
+  {
+    PROFILE_SCOPE("labeling");
+    labelBins(state.index, imgL.cols, cs);
+  }
+  addCounter(COUNTER_BINS, state.index.bins.size());
+  addCounter(COUNTER_COMPONENTS, cs.comps.size());
+
+  // partial decisions: the extended rows give the border test the neighbours outside the band
+  const int base = state.parent.size();
+  state.parent.resize(base + cs.comps.size());
+  state.shadow.resize(base + cs.comps.size());
+  const int chunk = 1024;
+  vector<function<void()> > tasks;
+  for(int begin = 0; begin < cs.comps.size(); begin += chunk){
+    int end = min(begin + chunk, (int) cs.comps.size());
+    tasks.push_back([&, begin, end]{
+      PROFILE_SCOPE("border test");
+      for(int c = begin; c < end; c++){
+        state.parent[base + c] = base + c;
+        state.shadow[base + c] = isShadowComponent(state.binImg, state.layout, cs, c);
+      }
+    });
+  }
+  scheduler.run(tasks);
+
+  // merge with the components touching the last row of the previous band
+  vector<SeamRun> first;
+  collectSeam(cs, y0 - extY0, base, first);
+  int p = 0;
+  for(int k = 0; k < first.size(); k++){
+    // runs of the previous row touch [colBegin, colEnd) if they overlap [colBegin - 1, colEnd]
+    while(p < state.seam.size() && state.seam[p].colEnd < first[k].colBegin){
+      p++;
+    }
+    for(int q = p; q < state.seam.size() && state.seam[q].colBegin <= first[k].colEnd; q++){
+      if(state.seam[q].bin == first[k].bin){
+        unite(state, state.seam[q].gid, first[k].gid);
+      }
+    }
+  }
+  collectSeam(cs, y1 - 1 - extY0, base, state.seam);
+
+  // spool the runs with image coordinates and global ids
+  vector<TiledRun> runs;
+  runs.reserve(cs.runs.size());
+  for(int c = 0; c < cs.comps.size(); c++){
+    const BinComponent& comp = cs.comps[c];
+    for(int r = comp.firstRun; r < comp.firstRun + comp.numRuns; r++){
+      TiledRun run = {cs.runs[r].row + extY0, cs.runs[r].colBegin, cs.runs[r].colEnd, base + c};
+      runs.push_back(run);
+    }
+  }
+  if(!runs.empty()){
+    fwrite(runs.data(), sizeof(TiledRun), runs.size(), state.runFile);
+  }
+  state.bandRuns.push_back(runs.size());
+}
+
+/**
+* This function paints the shadow pixels of a band, reading its runs from the temporary file. Bands must be
+* painted in the order they were labeled, after all of them have been labeled.
+*
+* @param state state carried between bands
+* @param band index of the band
+* @param y0 first row of the band
+* @param y1 row after the last row of the band
+* @param mask output mask of the band. Each SP is set to 255, every other pixel to 0
+*/
+void paintBand(TiledState& state, int band, int y0, int y1, Mat& mask){
+  PROFILE_SCOPE("paint");
+  mask.create(y1 - y0, state.cols, CV_8UC1);
+  mask.setTo(Scalar(0));
+
+  vector<TiledRun> runs(4096);
+  long long left = state.bandRuns[band];
+  while(left > 0){
+    size_t n = fread(runs.data(), sizeof(TiledRun), min(left, (long long) runs.size()), state.runFile);
+    if(n == 0){
+      break;
+    }
+    for(size_t r = 0; r < n; r++){
+      if(state.shadow[findRoot(state.parent, runs[r].gid)]){
+        memset(mask.ptr<uchar>(runs[r].row - y0) + runs[r].colBegin, 255, runs[r].colEnd - runs[r].colBegin);
+      }
+    }
+    left -= n;
+  }
+}
+
+/**
+* This function runs the tiled detection and writes the final mask as a binary PGM file. Binary PPM inputs are
+* read band by band; other formats are decoded by imread() first, so that only the processing is bounded.
+* The mask is the same as the one of the whole image with the bilateral and joint filters. With the half
+* resolution filter it is the same for images with an even number of rows, otherwise it may differ close
+* to the seams.
+*
+* @param srcPath input image path
+* @param lStep step used to group l* components. It must be positive
+* @param aStep step used to group a* components. It must be positive
+* @param bStep step used to group b* components. It must be positive
+* @param filter edge preserving filter. See ShadowPipeline.cpp
+* @param dstPath output PGM path
+* @param budgetMb memory budget of a band, in megabytes
+* @param scheduler pool of threads. See TaskScheduler.cpp for more details
+* @return 0 on success, 1 otherwise
+*/
+int runTiled(const string& srcPath, int lStep, int aStep, int bStep, FilterMode filter, const string& dstPath,
+    int budgetMb, TaskScheduler& scheduler){
+
+  chrono::time_point<chrono::system_clock> start = chrono::system_clock::now();
+
+  PpmTileSource ppm;
+  MatTileSource* decoded = 0;
+  TileSource* source = &ppm;
+  if(!ppm.open(srcPath)){
+    Mat img = imread(srcPath);
+    if(img.empty()){
+      cout << "Wrong argument! Can not open input image. Check for errors in the provided path" << endl;
+      return 1;
+    }
+    cout << "Not a binary PPM, the image is decoded in memory and processed by bands" << endl;
+    decoded = new MatTileSource(img);
+    source = decoded;
+  }
+
+  const int rows = source->rows();
+  const int cols = source->cols();
+  int bandRows = (int) min((long long) rows, max(16LL, (long long) budgetMb * 1024 * 1024 / ((long long) cols * bytesPerPixel)
+      - 2 * (filterHalo + 1)));
+  const int bands = (rows + bandRows - 1) / bandRows;
+  cout << "Image " << cols << "x" << rows << ", " << bands << " bands of " << bandRows << " rows" << endl;
+
+  // first pass: lightness statistics
+  int hist[256] = {0};
+  for(int y0 = 0; y0 < rows; y0 += bandRows){
+    int y1 = min(y0 + bandRows, rows);
+    Mat imgL, imgA, imgB;
+    if(!filterRows(*source, y0, y1, filter, imgL, imgA, imgB)){
+      cout << "Can not read rows " << y0 << " to " << y1 << endl;
+      delete decoded;
+      return 1;
+    }
+    int bandHist[256];
+    lightnessHistogram(imgL, bandHist);
+    for(int v = 0; v < 256; v++){
+      hist[v] += bandHist[v];
+    }
+  }
+
+  double meanL, stdDevL;
+  lightnessStats(hist, meanL, stdDevL);
+  bool useSTD = stdDevL >= (double) 255 / 6;
+  cout << "Mean lightness value: " << meanL << ", standard deviation: " << stdDevL << " useSTD: " << useSTD << endl;
+
+  // second pass: label bands and merge components across seams
+  TiledState state;
+  makeBinLayout(lStep, aStep, bStep, state.layout);
+  state.threshold = lightnessThreshold(useSTD ? meanL - stdDevL / 3 : meanL);
+  state.cols = cols;
+  state.runFile = tmpfile();
+  state.merges = 0;
+  if(state.runFile == 0){
+    cout << "Can not create the temporary file of runs" << endl;
+    delete decoded;
+    return 1;
+  }
+
+  for(int y0 = 0; y0 < rows; y0 += bandRows){
+    int y1 = min(y0 + bandRows, rows);
+    int extY0 = max(y0 - 1, 0);
+    int extY1 = min(y1 + 1, rows);
+    Mat imgL, imgA, imgB;
+    if(!filterRows(*source, extY0, extY1, filter, imgL, imgA, imgB)){
+      cout << "Can not read rows " << extY0 << " to " << extY1 << endl;
+      fclose(state.runFile);
+      delete decoded;
+      return 1;
+    }
+    labelBand(state, imgL, imgA, imgB, extY0, y0, y1, scheduler);
+  }
+  delete decoded;
+
+  // third pass: paint the mask band by band and write it
+  ofstream dst(dstPath.c_str(), ios::binary);
+  dst << "P5\n" << cols << " " << rows << "\n255\n";
+  rewind(state.runFile);
+  int band = 0;
+  for(int y0 = 0; y0 < rows; y0 += bandRows, band++){
+    int y1 = min(y0 + bandRows, rows);
+    Mat mask;
+    paintBand(state, band, y0, y1, mask);
+    PROFILE_SCOPE("encode");
+    for(int i = 0; i < mask.rows; i++){
+      dst.write((const char*) mask.ptr<uchar>(i), cols);
+    }
+  }
+  fclose(state.runFile);
+
+  if(!dst){
+    cout << "Can not write " << dstPath << endl;
+    return 1;
+  }
+
+  // provide information to the user
+  int elapsedMs = chrono::duration_cast<std::chrono::milliseconds> (chrono::system_clock::now() - start).count();
+  cout << "Components: " << state.parent.size() << ", merged across seams: " << state.merges << endl;
+  cout << "Mask written in " << dstPath << ". Elapsed time: " << elapsedMs << " ms" << endl;
+  return 0;
+}
@@ -0,0 +1,365 @@
+/**
+ * @file Video.cpp
+ * The goal of the code in this file is to process the frames of a fixed camera at video rate. Consecutive frames
+ * share most of their pixels, so each frame only updates what depends on the pixels that changed:
+ * 1) the frame is compared with the pixels the current planes were computed from, tile by tile. A tile changed
+ *    if one of its pixels differs by more than noiseLevel on a channel;
+ * 2) changed tiles and their neighbours, which see the change through the filter, are converted, filtered,
+ *    masked and binned again. The lightness histogram is updated with the difference, so mean and standard
+ *    deviation are carried forward without a pass over the whole frame;
+ * 3) the bin index and the labels are rebuilt for the whole frame, which is a linear pass over the PSP. A
+ *    component whose bounding box, grown by one pixel, does not touch a refiltered tile has the same pixels and
+ *    the same border of the previous frame, so it keeps the decision read from the previous mask. Only the other
+ *    components go through the border test.
+ * When the PSP threshold changes, every pixel and component is updated. Changes below noiseLevel are ignored, so
+ * a full update every keyframeInterval frames keeps the result from drifting away from a frame by frame run.
+ *
+ * @author Martini Davide
+ * @version 1.1
+ * @since 1.1
+ *
+ */
+
+#include "Video.h"
+
+const int tileSize = 32;
+const int noiseLevel = 8; // largest difference of a channel that is not considered a change
+const int keyframeInterval = 100;
+const int videoHalo = 8; // rows and columns read around a tile to filter it. See Tiled.cpp
+const int reportInterval = 100; // frames between two progress lines
+
+/**
+* Prepares the state for the first frame, which is always processed as a keyframe
+*/
+void initVideoState(VideoState& state, int lStep, int aStep, int bStep, FilterMode filter){
+  makeBinLayout(lStep, aStep, bStep, state.layout);
+  state.filter = filter;
+  state.current = 0;
+  state.threshold = -1;
+  state.reference.release();
+}
+
+/**
+* Marks the tiles whose pixels differ from the reference and the tiles around them
+*/
+static void findChangedTiles(VideoState& state, const Mat& frame){
+  const int rowBytes = frame.cols * 3;
+  for(int ty = 0; ty < state.tileRows; ty++){
+    const int y0 = ty * tileSize;
+    const int y1 = min(y0 + tileSize, frame.rows);
+    for(int tx = 0; tx < state.tileCols; tx++){
+      const int x0 = tx * tileSize * 3;
+      const int x1 = min(x0 + tileSize * 3, rowBytes);
+      uchar changed = 0;
+      for(int i = y0; i < y1 && !changed; i++){
+        const uchar* now = frame.ptr<uchar>(i);
+        const uchar* before = state.reference.ptr<uchar>(i);
+        for(int j = x0; j < x1; j++){
+          changed |= abs(now[j] - before[j]) > noiseLevel;
+        }
+      }
+      state.changed[ty * state.tileCols + tx] = changed;
+    }
+  }
+
+  // the filter spreads a change over a few pixels, so the tiles around a changed one are filtered again
+  for(int ty = 0; ty < state.tileRows; ty++){
+    for(int tx = 0; tx < state.tileCols; tx++){
+      uchar near = 0;
+      for(int dy = max(ty - 1, 0); dy <= min(ty + 1, state.tileRows - 1); dy++){
+        for(int dx = max(tx - 1, 0); dx <= min(tx + 1, state.tileCols - 1); dx++){
+          near |= state.changed[dy * state.tileCols + dx];
+        }
+      }
+      state.refiltered[ty * state.tileCols + tx] = near;
+    }
+  }
+}
+
+/**
+* Converts and filters the pixels of rect. The pixels around it are read as well and dropped after filtering
+*/
+static void refilterRect(VideoState& state, const Mat& frame, const Rect& rect){
+  const int x0 = max(rect.x - videoHalo, 0) & ~1;
+  const int y0 = max(rect.y - videoHalo, 0) & ~1;
+  const int x1 = min(rect.x + rect.width + videoHalo, frame.cols);
+  const int y1 = min(rect.y + rect.height + videoHalo, frame.rows);
+  const Rect ext(x0, y0, x1 - x0, y1 - y0);
+  const Rect core(rect.x - x0, rect.y - y0, rect.width, rect.height);
+
+  Mat imgLAB, planeL, planeA, planeB;
+  {
+    PROFILE_SCOPE("lab");
+    cvtColor(frame(ext), imgLAB, COLOR_RGB2Lab);
+  }
+  {
+    PROFILE_SCOPE("filter");
+    filterLab(imgLAB, state.filter, planeL, planeA, planeB);
+  }
+
+  // the histogram loses the old lightness values of rect and gains the new ones
+  for(int i = 0; i < rect.height; i++){
+    const uchar* before = state.imgL.ptr<uchar>(rect.y + i) + rect.x;
+    const uchar* now = planeL.ptr<uchar>(core.y + i) + core.x;
+    for(int j = 0; j < rect.width; j++){
+      state.hist[before[j]]--;
+      state.hist[now[j]]++;
+    }
+  }
+  Mat dstL = state.imgL(rect), dstA = state.imgA(rect), dstB = state.imgB(rect), dstRef = state.reference(rect);
+  planeL(core).copyTo(dstL);
+  planeA(core).copyTo(dstA);
+  planeB(core).copyTo(dstB);
+  frame(rect).copyTo(dstRef);
+}
+
+static void maskRect(VideoState& state, const Rect& rect){
+  for(int i = rect.y; i < rect.y + rect.height; i++){
+    maskAndBinsRow(state.imgL.ptr<uchar>(i) + rect.x, state.imgA.ptr<uchar>(i) + rect.x, state.imgB.ptr<uchar>(i) + rect.x,
+        rect.width, state.threshold, state.layout, state.maskAvgL.ptr<uchar>(i) + rect.x, state.binImg.ptr<int>(i) + rect.x);
+  }
+}
+
+/**
+* Returns true if the pixels of the component or its border lie in a refiltered tile
+*/
+static bool touchesRefiltered(const VideoState& state, const BinComponent& comp, int rows, int cols){
+  const int tx0 = max(comp.bbox.x - 1, 0) / tileSize;
+  const int ty0 = max(comp.bbox.y - 1, 0) / tileSize;
+  const int tx1 = min(comp.bbox.x + comp.bbox.width, cols - 1) / tileSize + 1;
+  const int ty1 = min(comp.bbox.y + comp.bbox.height, rows - 1) / tileSize + 1;
+  const int stride = state.tileCols + 1;
+  const vector<int>& sum = state.refilteredSum;
+  return sum[ty1 * stride + tx1] - sum[ty0 * stride + tx1] - sum[ty1 * stride + tx0] + sum[ty0 * stride + tx0] > 0;
+}
+
+/**
+* This function computes the final mask of a frame, reusing the work done on the previous frames.
+*
+* @param state state carried between frames. See initVideoState()
+* @param frame CV_8UC3 frame, as returned by VideoCapture. Every frame must have the size of the first one
+* @param keyframe if true, the frame is processed as a whole
+* @param scheduler pool of threads that analyzes the components. See TaskScheduler.cpp for more details
+* @param stats if it is not null, it receives information about the work done
+*/
+void processFrame(VideoState& state, const Mat& frame, bool keyframe, TaskScheduler& scheduler, FrameStats* stats){
+  const bool first = state.reference.empty() || state.reference.size() != frame.size();
+  if(first){
+    state.reference.create(frame.size(), CV_8UC3);
+    state.imgL.create(frame.size(), CV_8UC1);
+    state.imgA.create(frame.size(), CV_8UC1);
+    state.imgB.create(frame.size(), CV_8UC1);
+    state.maskAvgL.create(frame.size(), CV_8UC1);
+    state.binImg.create(frame.size(), CV_32SC1);
+    state.imgL.setTo(Scalar(0));
+    state.tileRows = (frame.rows + tileSize - 1) / tileSize;
+    state.tileCols = (frame.cols + tileSize - 1) / tileSize;
+    state.changed.assign(state.tileRows * state.tileCols, 1);
+    state.refiltered.assign(state.tileRows * state.tileCols, 1);
+    fill(state.hist, state.hist + 256, 0);
+    state.hist[0] = frame.rows * frame.cols; // imgL is all zeros
+    keyframe = true;
+  }
+
+  // 1) find the tiles to update
+  {
+    PROFILE_SCOPE("changes");
+    if(keyframe){
+      fill(state.changed.begin(), state.changed.end(), 1);
+      fill(state.refiltered.begin(), state.refiltered.end(), 1);
+    }
+    else{
+      findChangedTiles(state, frame);
+    }
+  }
+
+  // 2) filter them again, one span of consecutive tiles at a time. A keyframe is filtered as a whole
+  vector<Rect> spans;
+  if(keyframe){
+    spans.push_back(Rect(0, 0, frame.cols, frame.rows));
+  }
+  for(int ty = 0; ty < state.tileRows && !keyframe; ty++){
+    for(int tx = 0; tx < state.tileCols; tx++){
+      if(!state.refiltered[ty * state.tileCols + tx]){
+        continue;
+      }
+      int end = tx;
+      while(end < state.tileCols && state.refiltered[ty * state.tileCols + end]){
+        end++;
+      }
+      const int y0 = ty * tileSize;
+      const int x0 = tx * tileSize;
+      spans.push_back(Rect(x0, y0, min(end * tileSize, frame.cols) - x0, min(y0 + tileSize, frame.rows) - y0));
+      tx = end;
+    }
+  }
+  for(int s = 0; s < spans.size(); s++){
+    refilterRect(state, frame, spans[s]);
+  }
+
+  // the statistics come from the updated histogram. A new threshold changes the PSP of the whole frame
+  {
+    PROFILE_SCOPE("statistics");
+    lightnessStats(state.hist, state.meanL, state.stdDevL);
+  }
+  const bool useSTD = state.stdDevL >= (double) 255 / 6;
+  const int threshold = lightnessThreshold(useSTD ? state.meanL - state.stdDevL / 3 : state.meanL);
+  const bool fullUpdate = keyframe || threshold != state.threshold;
+  state.threshold = threshold;
+  {
+    PROFILE_SCOPE("mask");
+    if(fullUpdate){
+      maskRect(state, Rect(0, 0, frame.cols, frame.rows));
+    }
+    else{
+      for(int s = 0; s < spans.size(); s++){
+        maskRect(state, spans[s]);
+      }
+    }
+  }
+
+  // 3) label the whole frame. See BinIndex.cpp and LabelBins.cpp
+  ComponentSet& cs = state.cs;
+  {
+    PROFILE_SCOPE("binning");
+    buildBinIndex(state.binImg, state.maskAvgL, state.layout, state.index);
+  }
+  {
+    PROFILE_SCOPE("labeling");
+    labelBins(state.index, frame.cols, cs);
+  }
+  addCounter(COUNTER_IMAGES, 1);
+  addCounter(COUNTER_BINS, state.index.bins.size());
+  addCounter(COUNTER_COMPONENTS, cs.comps.size());
+
+  // components away from the refiltered tiles keep the decision stored in the previous mask
+  const int stride = state.tileCols + 1;
+  state.refilteredSum.assign((state.tileRows + 1) * stride, 0);
+  for(int ty = 0; ty < state.tileRows; ty++){
+    for(int tx = 0; tx < state.tileCols; tx++){
+      state.refilteredSum[(ty + 1) * stride + tx + 1] = state.refiltered[ty * state.tileCols + tx]
+          + state.refilteredSum[ty * stride + tx + 1] + state.refilteredSum[(ty + 1) * stride + tx]
+          - state.refilteredSum[ty * stride + tx];
+    }
+  }
+
+  const Mat& previous = state.masks[state.current];
+  state.shadow.resize(cs.comps.size());
+  state.affected.assign(cs.comps.size(), 0);
+  int analyzed = 0;
+  for(int c = 0; c < cs.comps.size(); c++){
+    const BinComponent& comp = cs.comps[c];
+    if(fullUpdate || touchesRefiltered(state, comp, frame.rows, frame.cols)){
+      state.affected[c] = 1;
+      analyzed++;
+    }
+    else{
+      const Run& run = cs.runs[comp.firstRun];
+      state.shadow[c] = previous.at<uchar>(run.row, run.colBegin) != 0;
+    }
+  }
+
+  // the other components go through the same tasks of detectShadows(). See ShadowPipeline.cpp
+  testBorders(state.binImg, state.layout, cs, &state.affected, scheduler, state.shadow);
+
+  // paint the new mask, keeping the previous one for the next frame
+  state.current = 1 - state.current;
+  Mat& mask = state.masks[state.current];
+  mask.create(frame.size(), CV_8UC1);
+  mask.setTo(Scalar(0));
+  paintShadows(cs, state.shadow, mask);
+
+  if(stats != 0){
+    stats->changedTiles = count(state.changed.begin(), state.changed.end(), 1);
+    stats->refilteredTiles = count(state.refiltered.begin(), state.refiltered.end(), 1);
+    stats->components = cs.comps.size();
+    stats->analyzedComponents = analyzed;
+    stats->fullUpdate = fullUpdate;
+  }
+}
+
+/**
+* This function runs the incremental detection over a video and optionally writes the masks as a video.
+*
+* @param input video file, or the index of a camera
+* @param lStep step used to group l* components. It must be positive
+* @param aStep step used to group a* components. It must be positive
+* @param bStep step used to group b* components. It must be positive
+* @param filter edge preserving filter. See ShadowPipeline.cpp
+* @param output output video path, .mkv or .avi. If it is empty, masks are not written
+* @param scheduler pool of threads. See TaskScheduler.cpp for more details
+* @return 0 on success, 1 if the input or the output can not be opened
+*/
+int runVideo(const string& input, int lStep, int aStep, int bStep, FilterMode filter, const string& output,
+    TaskScheduler& scheduler){
+
+  VideoCapture capture;
+  if(!input.empty() && input.find_first_not_of("0123456789") == string::npos){
+    capture = VideoCapture(atoi(input.c_str()));
+  }
+  else{
+    capture = VideoCapture(input);
+  }
+  if(!capture.isOpened()){
+    cout << "Wrong argument! Can not open input video. Check for errors in the provided path" << endl;
+    return 1;
+  }
+
+  VideoState state;
+  initVideoState(state, lStep, aStep, bStep, filter);
+  VideoWriter writer;
+  double fps = capture.get(CAP_PROP_FPS);
+
+  chrono::time_point<chrono::steady_clock> start = chrono::steady_clock::now();
+  chrono::time_point<chrono::steady_clock> reportStart = start;
+  long long frames = 0, tiles = 0, refiltered = 0, components = 0, analyzed = 0, fullUpdates = 0;
+  Mat frame;
+  while(true){
+    {
+      PROFILE_SCOPE("load");
+      if(!capture.read(frame) || frame.empty()){
+        break;
+      }
+    }
+    if(frame.type() != CV_8UC3){
+      cout << "Frame " << frames << " is not a 3 channel 8 bit image, stopped" << endl;
+      break;
+    }
+
+    FrameStats stats;
+    processFrame(state, frame, frames % keyframeInterval == 0, scheduler, &stats);
+    frames++;
+    tiles += state.tileRows * state.tileCols;
+    refiltered += stats.refilteredTiles;
+    components += stats.components;
+    analyzed += stats.analyzedComponents;
+    fullUpdates += stats.fullUpdate;
+
+    if(!output.empty()){
+      PROFILE_SCOPE("encode");
+      if(!writer.isOpened()){
+        // FFV1 is lossless, so the written masks stay binary
+        writer = VideoWriter(output, VideoWriter::fourcc('F', 'F', 'V', '1'), fps > 0 ? fps : 25, frame.size(), false);
+        if(!writer.isOpened()){
+          cout << "Can not write " << output << endl;
+          return 1;
+        }
+      }
+      writer.write(state.masks[state.current]);
+    }
+
+    // provide information to the user
+    if(frames % reportInterval == 0){
+      double seconds = chrono::duration_cast<chrono::microseconds> (chrono::steady_clock::now() - reportStart).count() / 1e6;
+      cout << "Frames: " << frames << ", fps: " << reportInterval / seconds << ", refiltered tiles: "
+           << 100. * refiltered / tiles << "%, analyzed components: " << 100. * analyzed / max(components, 1LL) << "%" << endl;
+      reportStart = chrono::steady_clock::now();
+    }
+  }
+
+  double seconds = chrono::duration_cast<chrono::microseconds> (chrono::steady_clock::now() - start).count() / 1e6;
+  cout << "Processed " << frames << " frames in " << seconds << " s (" << frames / max(seconds, 1e-9) << " fps). Full updates: "
+       << fullUpdates << ", refiltered tiles: " << 100. * refiltered / max(tiles, 1LL) << "%, analyzed components: "
+       << 100. * analyzed / max(components, 1LL) << "%" << endl;
+  return 0;
+}